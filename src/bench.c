@@ -0,0 +1,258 @@
+#include "common.h"
+#include <time.h>
+#include <unistd.h>
+
+#include "crc32.h"
+#include "debug_map.h"
+#include "driver.h"
+#include "file.h"
+#include "f/debugger.h"
+#include "f/loader.h"
+#include "f/machine.h"
+#include "f/profiler.h"
+
+#define DEFAULT_FRAMES 3600
+#define MAX_DEBUG_ADDRS 16
+
+typedef struct DebugAddr {
+    uint16_t addr;
+    uint8_t flags; // WatchFlag, or none for a breakpoint
+} DebugAddr;
+
+static double get_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static bool parse_debug_addr(DebugAddr *addrs, int *len, const char *arg,
+                             uint8_t flags) {
+    char *end;
+    const long addr = strtol(arg, &end, 16);
+    if (*len == MAX_DEBUG_ADDRS || *end || end == arg || addr < 0 ||
+        addr > 0xFFFF) {
+        return false;
+    }
+    addrs[*len].addr = addr;
+    addrs[(*len)++].flags = flags;
+    return true;
+}
+
+static void print_stop(Debugger *dbg, int frame) {
+    static const char *reasons[] = {"", "Breakpoint", "Read", "Write"};
+    Machine *vm = dbg->vm;
+    CPU65xx *cpu = &vm->cpu;
+    printf("%s $%04x=%02x at $%04x", reasons[dbg->stop], dbg->stop_addr,
+           dbg->stop_value, dbg->stop_pc);
+    const DebugLabel *label = (vm->dbg_map ?
+                               debug_map_find(vm->dbg_map, dbg->stop_pc) :
+                               NULL);
+    if (label) {
+        printf(" (%s+%d)", label->name, dbg->stop_pc - label->addr);
+    }
+    printf(": A=%02x X=%02x Y=%02x P=%02x S=%02x PC=%04x "
+           "(frame %d, PPU %d,%d)\n",
+           cpu->a, cpu->x, cpu->y, cpu_65xx_get_p(cpu), cpu->s, cpu->pc,
+           frame, dbg->pos.scanline, dbg->pos.cycle);
+}
+
+int main(int argc, char *argv[]) {
+    eprintf("%s-bench build %s (%s)\n", APP_NAME, BUILD_ID, APP_HOMEPAGE);
+    const char *app_path = argv[0];
+    CPU65xxEngine engine = ENGINE_BLOCK;
+    const char *profile_path = NULL;
+    const char *labels_path = NULL;
+    DebugAddr debug_addrs[MAX_DEBUG_ADDRS];
+    int debug_addrs_len = 0;
+    ScreenFormat screen_format = SF_ARGB8888;
+    int opt;
+    while ((opt = getopt(argc, argv, "b:e:f:l:p:r:w:")) != -1) {
+        switch (opt) {
+            case 'b':
+            case 'r':
+            case 'w':
+                if (!parse_debug_addr(debug_addrs, &debug_addrs_len, optarg,
+                                      (opt == 'r' ? WP_READ :
+                                       (opt == 'w' ? WP_WRITE : 0)))) {
+                    eprintf("%s: Invalid address\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'e':
+                if (!strcmp(optarg, "reference")) {
+                    engine = ENGINE_REFERENCE;
+                } else if (!strcmp(optarg, "specialized")) {
+                    engine = ENGINE_SPECIALIZED;
+                } else if (!strcmp(optarg, "block")) {
+                    engine = ENGINE_BLOCK;
+                } else {
+                    eprintf("%s: Unknown CPU engine\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'f':
+                if (!strcmp(optarg, "argb8888")) {
+                    screen_format = SF_ARGB8888;
+                } else if (!strcmp(optarg, "rgb565")) {
+                    screen_format = SF_RGB565;
+                } else if (!strcmp(optarg, "indexed")) {
+                    screen_format = SF_INDEXED;
+                } else {
+                    eprintf("%s: Unknown screen format\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'l':
+                labels_path = optarg;
+                break;
+            case 'p':
+                profile_path = optarg;
+                break;
+            default:
+                argc = 0;
+                break;
+        }
+    }
+    argc -= optind;
+    argv += optind;
+    if (argc < 1) {
+        eprintf("Usage: %s [-e reference|specialized|block] "
+                "[-f argb8888|rgb565|indexed] [-l labels.map] "
+                "[-p profile_prefix] [-b addr] [-r addr] [-w addr] "
+                "rom_file [frames]\n", app_path);
+        return 1;
+    }
+    int frames = DEFAULT_FRAMES;
+    if (argc >= 2) {
+        frames = atoi(argv[1]);
+        if (frames <= 0) {
+            eprintf("%s: Invalid frame count\n", argv[1]);
+            return 1;
+        }
+    }
+
+    // Load the entire file in memory
+    blob rom;
+    if (!load_file(argv[0], &rom)) {
+        return 1;
+    }
+    if (rom.size < 1024) {
+        eprintf("%s: File is too small\n", argv[0]);
+        return 1;
+    }
+
+    Driver driver;
+    memset(&driver, 0, sizeof(Driver));
+    driver.input.lightgun_pos = -1;
+    driver.screen_format = screen_format;
+
+    // Symbols for the profiler and debugger output
+    DebugMap *dbg_map = NULL;
+    if (labels_path) {
+        dbg_map = malloc(sizeof(DebugMap));
+        if (!debug_map_load(dbg_map, labels_path)) {
+            eprintf("%s: Error opening file\n", labels_path);
+            return 1;
+        }
+        driver.dbg_map = dbg_map;
+    }
+
+    // Only the iNES loader is usable without SDL
+    eprintf("%s: ", argv[0]);
+    if (strncmp((const char *)rom.data, "NES\x1a", 4)) {
+        eprintf("Not an iNES file\n");
+        return 1;
+    }
+    eprintf("iNES file format\n");
+    int error_code = ines_loader(&driver, &rom);
+    if (error_code) {
+        return error_code;
+    }
+    Machine *vm = driver.vm;
+    vm->cpu.engine = engine;
+
+    // Profiling runs the CPU one instruction at a time
+    Profiler profiler;
+    if (profile_path) {
+        profiler_init(&profiler, vm);
+        vm->profiler = &profiler;
+    }
+
+    // So does debugging, only the memory being watched gets slower
+    Debugger debugger;
+    if (debug_addrs_len) {
+        debugger_init(&debugger, vm);
+        for (int i = 0; i < debug_addrs_len; i++) {
+            if (debug_addrs[i].flags) {
+                debugger_set_watchpoint(&debugger, debug_addrs[i].addr,
+                                        debug_addrs[i].flags);
+            } else {
+                debugger_set_breakpoint(&debugger, debug_addrs[i].addr, true);
+            }
+        }
+        vm->debugger = &debugger;
+    }
+
+    // Run as fast as possible, no pacing and no output devices
+    const double t_start = get_time();
+    for (driver.frame = 0; driver.frame < frames; driver.frame++) {
+        (*driver.advance_frame_func)(driver.vm, driver.frame);
+        while (vm->debugger && debugger.stopped) {
+            print_stop(&debugger, driver.frame);
+            (*driver.advance_frame_func)(driver.vm, driver.frame);
+        }
+    }
+    const double elapsed = get_time() - t_start;
+
+    const uint64_t cpu_clk = vm->mclk / T_CPU_MULTIPLIER;
+    printf("Ran %d frames in %.3f s\n", frames, elapsed);
+    printf("Frames/sec: %.2f\n", frames / elapsed);
+    printf("Emulated CPU clock: %.3f MHz\n", cpu_clk / elapsed / 1e6);
+    printf("Time per frame: %.0f ns\n", elapsed * 1e9 / frames);
+
+    // Checksums of the final state, for comparing runs
+    blob screen = {.data = driver.screens[(frames - 1) & 1],
+                   .size = driver.screen_size};
+    blob wram = {.data = vm->wram, .size = SIZE_WRAM};
+    printf("Screen CRC32: %08X\n", crc32(&screen));
+    printf("WRAM CRC32: %08X\n", crc32(&wram));
+
+    if (profile_path) {
+        const size_t path_len = strlen(profile_path) + 8;
+        char *path = malloc(path_len);
+        snprintf(path, path_len, "%s.txt", profile_path);
+        FILE *f = fopen(path, "w");
+        if (f) {
+            profiler_write_report(&profiler, f);
+            fclose(f);
+        } else {
+            eprintf("%s: Error opening file\n", path);
+        }
+        snprintf(path, path_len, "%s.folded", profile_path);
+        f = fopen(path, "w");
+        if (f) {
+            profiler_write_collapsed(&profiler, f);
+            fclose(f);
+        } else {
+            eprintf("%s: Error opening file\n", path);
+        }
+        free(path);
+        profiler_teardown(&profiler);
+    }
+
+    if (vm->debugger) {
+        vm->debugger = NULL;
+        debugger_teardown(&debugger);
+    }
+
+    if (driver.teardown_func) {
+        (*driver.teardown_func)(&driver);
+    }
+    if (dbg_map) {
+        debug_map_teardown(dbg_map);
+        free(dbg_map);
+    }
+    free(rom.data);
+
+    return 0;
+}
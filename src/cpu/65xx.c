@@ -2,17 +2,48 @@
 
 // MISC. //
 
+// Common sequences that blocks run as a single step. Other than the last
+// one, their instructions have fixed timings and no control flow.
+typedef enum {
+    FUSION_UNKNOWN = 0, // Following instructions not decoded yet
+    FUSION_NONE,
+    FUSION_LDA_STA,     // LDA #/zp/abs, STA zp/abs
+    FUSION_DEX_BNE,
+    FUSION_DEY_BNE,
+    FUSION_INX_CPX_BNE, // CPX #
+    FUSION_INY_CPY_BNE, // CPY #
+    FUSION_LDA_CMP_BEQ, // LDA zp, CMP #
+    FUSION_CLC_ADC      // ADC #/zp/abs
+} Fusion;
+
 static int apply_page_boundary_penalty(uint16_t a, uint16_t b) {
     return (a >> 8) != (b >> 8);
 }
 
 // MEMORY I/O //
 
+static bool is_block_poll(CPU65xx *cpu, uint16_t addr) {
+    return cpu->block_poll &&
+           (addr & cpu->block_poll_mask) == cpu->block_poll_addr;
+}
+
 static inline uint8_t mem_read(CPU65xx *cpu, uint16_t addr) {
+    if (cpu->in_block && !(cpu->block_access[addr >> 8] & BA_READ) &&
+        !is_block_poll(cpu, addr)) {
+        cpu->block_exit = true;
+        return 0;
+    }
     return (*cpu->read_func)(cpu->mm, addr);
 }
 
 static inline void mem_write(CPU65xx *cpu, uint16_t addr, uint8_t value) {
+    if (cpu->in_block) {
+        if (cpu->block_exit || !(cpu->block_access[addr >> 8] & BA_WRITE)) {
+            cpu->block_exit = true;
+            return;
+        }
+        cpu->block_writes++;
+    }
     (*cpu->write_func)(cpu->mm, addr, value);
 }
 
@@ -22,19 +53,121 @@ static inline uint16_t mem_read_word(CPU65xx *cpu, uint16_t addr) {
 
 // P.STATUS REGISTER //
 
-static bool get_p_flag(CPU65xx *cpu, PFlag flag) {
-    return cpu->p & flag;
+static inline void set_p_nz(CPU65xx *cpu, bool n, bool z) {
+    cpu->nz = (n << 8) | !z;
+}
+
+static inline bool get_p_flag(CPU65xx *cpu, PFlag flag) {
+    switch (flag) {
+        case P_N:
+            return cpu->nz & 0x180;
+        case P_Z:
+            return !(cpu->nz & 0xff);
+        case P_C:
+            return cpu->c;
+        case P_V:
+            return cpu->v;
+        default:
+            return cpu->p & flag;
+    }
+}
+
+static inline void set_p_flag(CPU65xx *cpu, PFlag flag, bool value) {
+    switch (flag) {
+        case P_N:
+            set_p_nz(cpu, value, get_p_flag(cpu, P_Z));
+            break;
+        case P_Z:
+            set_p_nz(cpu, get_p_flag(cpu, P_N), value);
+            break;
+        case P_C:
+            cpu->c = value;
+            break;
+        case P_V:
+            cpu->v = value;
+            break;
+        default: {
+            const uint8_t pos_mask = -value & flag;     // All 0 if val == 0
+            const uint8_t neg_mask = ~(-!value & flag); // All 1 if val == 1
+            cpu->p = (cpu->p | pos_mask) & neg_mask;
+            break;
+        }
+    }
+}
+
+static inline void apply_p_nz(CPU65xx *cpu, uint8_t value) {
+    cpu->nz = value;
+}
+
+static uint8_t get_p(CPU65xx *cpu) {
+    return (cpu->p & ~(P_N | P_Z | P_C | P_V)) |
+           (get_p_flag(cpu, P_N) ? P_N : 0) | (get_p_flag(cpu, P_Z) ? P_Z : 0) |
+           (cpu->c ? P_C : 0) | (cpu->v ? P_V : 0);
 }
 
-static void set_p_flag(CPU65xx *cpu, PFlag flag, bool value) {
-    const uint8_t pos_mask = -value & flag;     // All 0 if val == 0
-    const uint8_t neg_mask = ~(-!value & flag); // All 1 if val == 1
-    cpu->p = (cpu->p | pos_mask) & neg_mask;
+static void set_p(CPU65xx *cpu, uint8_t value) {
+    cpu->p = value;
+    set_p_nz(cpu, value & P_N, value & P_Z);
+    cpu->c = !!(value & P_C);
+    cpu->v = value & P_V;
 }
 
-static void apply_p_nz(CPU65xx *cpu, uint8_t value) {
-    set_p_flag(cpu, P_Z, !value);
-    set_p_flag(cpu, P_N, value & (1 << 7));
+// ALU //
+
+static inline void alu_adc(CPU65xx *cpu, uint8_t value) {
+    uint8_t carry = get_p_flag(cpu, P_C);
+    set_p_flag(cpu, P_C, ((int)(cpu->a) + (int)carry + (int)value) >= 0x100);
+    uint8_t result = cpu->a + carry + value;
+    set_p_flag(cpu, P_V, (result & (1 << 7)) != (cpu->a & (1 << 7)));
+    cpu->a = result;
+    apply_p_nz(cpu, cpu->a);
+}
+
+static inline void alu_sbc(CPU65xx *cpu, uint8_t value) {
+    uint8_t carry = get_p_flag(cpu, P_C);
+    set_p_flag(cpu, P_C, ((int)(cpu->a) + (int)carry - 1 - (int)value) >= 0);
+    uint8_t result = cpu->a + carry - 1 - value;
+    set_p_flag(cpu, P_V, (result & (1 << 7)) != (cpu->a & (1 << 7)));
+    cpu->a = result;
+    apply_p_nz(cpu, cpu->a);
+}
+
+static inline void alu_cmp(CPU65xx *cpu, uint8_t reg, uint8_t value) {
+    set_p_flag(cpu, P_C, ((int)reg - (int)value) >= 0);
+    apply_p_nz(cpu, reg - value);
+}
+
+static inline void alu_bit(CPU65xx *cpu, uint8_t value) {
+    set_p_nz(cpu, value & (1 << 7), !(cpu->a & value));
+    set_p_flag(cpu, P_V, value & (1 << 6));
+}
+
+static inline uint8_t alu_shift_left(CPU65xx *cpu, uint8_t value,
+                                     uint8_t carry) {
+    set_p_flag(cpu, P_C, value & (1 << 7));
+    value = (value << 1) | carry;
+    apply_p_nz(cpu, value);
+    return value;
+}
+static inline uint8_t alu_asl(CPU65xx *cpu, uint8_t value) {
+    return alu_shift_left(cpu, value, 0);
+}
+static inline uint8_t alu_rol(CPU65xx *cpu, uint8_t value) {
+    return alu_shift_left(cpu, value, get_p_flag(cpu, P_C));
+}
+
+static inline uint8_t alu_shift_right(CPU65xx *cpu, uint8_t value,
+                                      uint8_t carry) {
+    set_p_flag(cpu, P_C, value & 1);
+    value = (value >> 1) | carry;
+    apply_p_nz(cpu, value);
+    return value;
+}
+static inline uint8_t alu_lsr(CPU65xx *cpu, uint8_t value) {
+    return alu_shift_right(cpu, value, 0);
+}
+static inline uint8_t alu_ror(CPU65xx *cpu, uint8_t value) {
+    return alu_shift_right(cpu, value, get_p_flag(cpu, P_C) << 7);
 }
 
 // STACK REGISTER //
@@ -69,7 +202,7 @@ static int interrupt(CPU65xx *cpu, bool b_flag, uint16_t ivt_addr) {
         cpu->s -= 3;
     } else {
         stack_push_word(cpu, cpu->pc);
-        stack_push(cpu, cpu->p);
+        stack_push(cpu, get_p(cpu));
     }
     set_p_flag(cpu, P_I, true);
     cpu->pc = mem_read_word(cpu, ivt_addr);
@@ -107,41 +240,29 @@ static int op_ST(CPU65xx *cpu, const Opcode *op, OpParam param) {
 static int op_PH(CPU65xx *cpu, const Opcode *op, OpParam param) {
     uint8_t value = *op->reg1;
     if (op->reg1 == &cpu->p) {
-        value |= P_B | P__;
+        value = get_p(cpu) | P_B | P__;
     }
     stack_push(cpu, value);
     return 0;
 }
 
 static int op_PL(CPU65xx *cpu, const Opcode *op, OpParam param) {
-    *op->reg1 = stack_pull(cpu);
     if (op->reg1 == &cpu->p) {
-        *op->reg1 &= ~(P_B | P__);
+        set_p(cpu, stack_pull(cpu) & ~(P_B | P__));
     } else {
+        *op->reg1 = stack_pull(cpu);
         apply_p_nz(cpu, *op->reg1);
     }
     return 0;
 }
 
 static int op_ADC(CPU65xx *cpu, const Opcode *op, OpParam param) {
-    uint8_t value = get_param_value(cpu, op, param);
-    uint8_t carry = get_p_flag(cpu, P_C);
-    set_p_flag(cpu, P_C, ((int)(cpu->a) + (int)carry + (int)value) >= 0x100);
-    uint8_t result = cpu->a + carry + value;
-    set_p_flag(cpu, P_V, (result & (1 << 7)) != (cpu->a & (1 << 7)));
-    cpu->a = result;
-    apply_p_nz(cpu, cpu->a);
+    alu_adc(cpu, get_param_value(cpu, op, param));
     return 0;
 }
 
 static int op_SBC(CPU65xx *cpu, const Opcode *op, OpParam param) {
-    uint8_t value = get_param_value(cpu, op, param);
-    uint8_t carry = get_p_flag(cpu, P_C);
-    set_p_flag(cpu, P_C, ((int)(cpu->a) + (int)carry - 1 - (int)value) >= 0);
-    uint8_t result = cpu->a + carry - 1 - value;
-    set_p_flag(cpu, P_V, (result & (1 << 7)) != (cpu->a & (1 << 7)));
-    cpu->a = result;
-    apply_p_nz(cpu, cpu->a);
+    alu_sbc(cpu, get_param_value(cpu, op, param));
     return 0;
 }
 
@@ -164,17 +285,12 @@ static int op_ORA(CPU65xx *cpu, const Opcode *op, OpParam param) {
 }
 
 static int op_CMP(CPU65xx *cpu, const Opcode *op, OpParam param) {
-    uint8_t value = get_param_value(cpu, op, param);
-    set_p_flag(cpu, P_C, ((int)(*op->reg1) - (int)value) >= 0);
-    apply_p_nz(cpu, *op->reg1 - value);
+    alu_cmp(cpu, *op->reg1, get_param_value(cpu, op, param));
     return 0;
 }
 
 static int op_BIT(CPU65xx *cpu, const Opcode *op, OpParam param) {
-    uint8_t value = get_param_value(cpu, op, param);
-    set_p_flag(cpu, P_Z, !(cpu->a & value));
-    set_p_flag(cpu, P_N, value & (1 << 7));
-    set_p_flag(cpu, P_V, value & (1 << 6));
+    alu_bit(cpu, get_param_value(cpu, op, param));
     return 0;
 }
 
@@ -202,53 +318,29 @@ static int op_DE(CPU65xx *cpu, const Opcode *op, OpParam param) {
     return 0;
 }
 
-static void shift_left(CPU65xx *cpu, const Opcode *op, OpParam param,
-                       uint8_t carry) {
+static void shift(CPU65xx *cpu, const Opcode *op, OpParam param,
+                  uint8_t (*alu_func)(CPU65xx *, uint8_t)) {
     if (op->reg1) {
-        set_p_flag(cpu, P_C, *op->reg1 & (1 << 7));
-        *op->reg1 <<= 1;
-        *op->reg1 |= carry;
-        apply_p_nz(cpu, *op->reg1);
+        *op->reg1 = alu_func(cpu, *op->reg1);
     } else {
-        uint8_t value = get_param_value(cpu, op, param);
-        set_p_flag(cpu, P_C, value & (1 << 7));
-        value <<= 1;
-        value |= carry;
-        mem_write(cpu, param.addr, value);
-        apply_p_nz(cpu, value);
+        mem_write(cpu, param.addr,
+                  alu_func(cpu, get_param_value(cpu, op, param)));
     }
 }
 static int op_ASL(CPU65xx *cpu, const Opcode *op, OpParam param) {
-    shift_left(cpu, op, param, 0);
+    shift(cpu, op, param, alu_asl);
     return 0;
 }
 static int op_ROL(CPU65xx *cpu, const Opcode *op, OpParam param) {
-    shift_left(cpu, op, param, get_p_flag(cpu, P_C));
+    shift(cpu, op, param, alu_rol);
     return 0;
 }
-
-static void shift_right(CPU65xx *cpu, const Opcode *op, OpParam param,
-                        uint8_t carry) {
-    if (op->reg1) {
-        set_p_flag(cpu, P_C, *op->reg1 & 1);
-        *op->reg1 >>= 1;
-        *op->reg1 |= carry;
-        apply_p_nz(cpu, *op->reg1);
-    } else {
-        uint8_t value = get_param_value(cpu, op, param);
-        set_p_flag(cpu, P_C, value & 1);
-        value >>= 1;
-        value |= carry;
-        mem_write(cpu, param.addr, value);
-        apply_p_nz(cpu, value);
-    }
-}
 static int op_LSR(CPU65xx *cpu, const Opcode *op, OpParam param) {
-    shift_right(cpu, op, param, 0);
+    shift(cpu, op, param, alu_lsr);
     return 0;
 }
 static int op_ROR(CPU65xx *cpu, const Opcode *op, OpParam param) {
-    shift_right(cpu, op, param, get_p_flag(cpu, P_C) << 7);
+    shift(cpu, op, param, alu_ror);
     return 0;
 }
 
@@ -264,7 +356,7 @@ static int op_JSR(CPU65xx *cpu, const Opcode *op, OpParam param) {
 }
 
 static int op_RTI(CPU65xx *cpu, const Opcode *op, OpParam param) {
-    cpu->p = stack_pull(cpu) & ~(P_B | P__);
+    set_p(cpu, stack_pull(cpu) & ~(P_B | P__));
     cpu->pc = stack_pull_word(cpu);
     return 0;
 }
@@ -274,15 +366,19 @@ static int op_RTS(CPU65xx *cpu, const Opcode *op, OpParam param) {
     return 0;
 }
 
-static int cond_branch(CPU65xx *cpu, OpParam param, PFlag flag, bool value) {
+static int branch(CPU65xx *cpu, int8_t relative_addr, PFlag flag,
+                  bool value) {
     if (get_p_flag(cpu, flag) != value) {
         return 0;
     }
-    uint16_t new_pc = cpu->pc + param.relative_addr;
+    uint16_t new_pc = cpu->pc + relative_addr;
     int t = 1 + apply_page_boundary_penalty(cpu->pc, new_pc);
     cpu->pc = new_pc;
     return t;
 }
+static int cond_branch(CPU65xx *cpu, OpParam param, PFlag flag, bool value) {
+    return branch(cpu, param.relative_addr, flag, value);
+}
 static int op_BPL(CPU65xx *cpu, const Opcode *op, OpParam param) {
     return cond_branch(cpu, param, P_N, false);
 }
@@ -346,17 +442,865 @@ static int op_NOP(CPU65xx *cpu, const Opcode *op, OpParam param) {
     return 0;
 }
 
+// SPECIALIZED ENGINE //
+
+// Operand size in bytes of every opcode, including the opcode itself
+static const uint8_t op_sizes[0x100] = {
+    1, 2, 1, 1, 1, 2, 2, 1, 1, 2, 1, 1, 1, 3, 3, 1, // 0_
+    2, 2, 1, 1, 1, 2, 2, 1, 1, 3, 1, 1, 1, 3, 3, 1, // 1_
+    3, 2, 1, 1, 2, 2, 2, 1, 1, 2, 1, 1, 3, 3, 3, 1, // 2_
+    2, 2, 1, 1, 1, 2, 2, 1, 1, 3, 1, 1, 1, 3, 3, 1, // 3_
+    1, 2, 1, 1, 1, 2, 2, 1, 1, 2, 1, 1, 3, 3, 3, 1, // 4_
+    2, 2, 1, 1, 1, 2, 2, 1, 1, 3, 1, 1, 1, 3, 3, 1, // 5_
+    1, 2, 1, 1, 1, 2, 2, 1, 1, 2, 1, 1, 3, 3, 3, 1, // 6_
+    2, 2, 1, 1, 1, 2, 2, 1, 1, 3, 1, 1, 1, 3, 3, 1, // 7_
+    1, 2, 1, 1, 2, 2, 2, 1, 1, 1, 1, 1, 3, 3, 3, 1, // 8_
+    2, 2, 1, 1, 2, 2, 2, 1, 1, 3, 1, 1, 1, 3, 1, 1, // 9_
+    2, 2, 2, 1, 2, 2, 2, 1, 1, 2, 1, 1, 3, 3, 3, 1, // A_
+    2, 2, 1, 1, 2, 2, 2, 1, 1, 3, 1, 1, 3, 3, 3, 1, // B_
+    2, 2, 1, 1, 2, 2, 2, 1, 1, 2, 1, 1, 3, 3, 3, 1, // C_
+    2, 2, 1, 1, 1, 2, 2, 1, 1, 3, 1, 1, 1, 3, 3, 1, // D_
+    2, 2, 1, 1, 2, 2, 2, 1, 1, 2, 1, 1, 3, 3, 3, 1, // E_
+    2, 2, 1, 1, 1, 2, 2, 1, 1, 3, 1, 1, 1, 3, 3, 1, // F_
+};
+
+static void fetch(CPU65xx *cpu, CPU65xxDecoded *decoded) {
+    decoded->inst = mem_read(cpu, cpu->pc++);
+    decoded->operand = 0;
+    decoded->fusion = FUSION_UNKNOWN;
+    decoded->size = op_sizes[decoded->inst];
+    switch (decoded->size) {
+        case 1:
+            // Implied always does a dummy parameter read of the next byte
+            decoded->bus = mem_read(cpu, cpu->pc);
+            break;
+        case 2:
+            decoded->operand = decoded->bus = mem_read(cpu, cpu->pc++);
+            break;
+        case 3:
+            decoded->operand = mem_read_word(cpu, cpu->pc);
+            decoded->bus = decoded->operand >> 8;
+            cpu->pc += 2;
+            break;
+    }
+}
+
+// Fetches through read_func, then caches the result if the page allows it
+static void fetch_and_decode(CPU65xx *cpu, CPU65xxDecoded *fetched) {
+    CPU65xxDecoded *decoded = cpu->decoded[cpu->pc >> DECODED_PAGE_SHIFT];
+    uint16_t offset = cpu->pc & MASK_DECODED_PAGE;
+    fetch(cpu, fetched);
+    // Instructions straddling two pages (including the dummy read) aren't
+    // cached, as the next page can be switched independently
+    int span = (fetched->size > 2 ? fetched->size : 2);
+    if (decoded && offset + span <= MASK_DECODED_PAGE + 1) {
+        decoded[offset] = *fetched;
+    }
+}
+
+// Same semantics as step_reference(), but with the addressing mode and the
+// operation of each opcode resolved at compile time in a single switch
+static int step_specialized(CPU65xx *cpu) {
+    if (cpu->nmi) {
+        cpu->nmi = false;
+        return interrupt(cpu, false, IVT_NMI);
+    }
+    if (cpu->irq && !get_p_flag(cpu, P_I)) {
+        return interrupt(cpu, false, IVT_IRQ);
+    }
+
+    CPU65xxDecoded fetched = {0};
+    const CPU65xxDecoded *decoded = cpu->decoded[cpu->pc >> DECODED_PAGE_SHIFT];
+    if (decoded && decoded[cpu->pc & MASK_DECODED_PAGE].size) {
+        decoded += cpu->pc & MASK_DECODED_PAGE;
+        cpu->pc += decoded->size;
+        *cpu->open_bus = decoded->bus;
+    } else {
+        fetch_and_decode(cpu, &fetched);
+        decoded = &fetched;
+    }
+    const uint8_t inst = decoded->inst;
+    const uint16_t operand = decoded->operand;
+
+    uint16_t addr;
+    uint8_t value;
+    switch (inst) {
+        case 0xA8: // TAY
+            cpu->y = cpu->a;
+            apply_p_nz(cpu, cpu->y);
+            return 2;
+        case 0xAA: // TAX
+            cpu->x = cpu->a;
+            apply_p_nz(cpu, cpu->x);
+            return 2;
+        case 0xBA: // TSX
+            cpu->x = cpu->s;
+            apply_p_nz(cpu, cpu->x);
+            return 2;
+        case 0x98: // TYA
+            cpu->a = cpu->y;
+            apply_p_nz(cpu, cpu->a);
+            return 2;
+        case 0x8A: // TXA
+            cpu->a = cpu->x;
+            apply_p_nz(cpu, cpu->a);
+            return 2;
+        case 0x9A: // TXS
+            cpu->s = cpu->x;
+            return 2;
+        case 0xA9: // LDA #
+            cpu->a = operand;
+            apply_p_nz(cpu, cpu->a);
+            return 2;
+        case 0xA5: // LDA zp
+            cpu->a = mem_read(cpu, operand);
+            apply_p_nz(cpu, cpu->a);
+            return 3;
+        case 0xB5: // LDA zp,X
+            addr = (uint8_t)(operand + cpu->x);
+            cpu->a = mem_read(cpu, addr);
+            apply_p_nz(cpu, cpu->a);
+            return 4;
+        case 0xAD: // LDA abs
+            cpu->a = mem_read(cpu, operand);
+            apply_p_nz(cpu, cpu->a);
+            return 4;
+        case 0xBD: // LDA abs,X
+            addr = operand + cpu->x;
+            cpu->a = mem_read(cpu, addr);
+            apply_p_nz(cpu, cpu->a);
+            return 4 + apply_page_boundary_penalty(operand, addr);
+        case 0xB9: // LDA abs,Y
+            addr = operand + cpu->y;
+            cpu->a = mem_read(cpu, addr);
+            apply_p_nz(cpu, cpu->a);
+            return 4 + apply_page_boundary_penalty(operand, addr);
+        case 0xA1: // LDA (zp,X)
+            addr = mem_read_word(cpu, (uint8_t)(operand + cpu->x));
+            cpu->a = mem_read(cpu, addr);
+            apply_p_nz(cpu, cpu->a);
+            return 6;
+        case 0xB1: // LDA (zp),Y
+            addr = mem_read_word(cpu, operand) + cpu->y;
+            cpu->a = mem_read(cpu, addr);
+            apply_p_nz(cpu, cpu->a);
+            return 5 + apply_page_boundary_penalty(operand, addr);
+        case 0xA2: // LDX #
+            cpu->x = operand;
+            apply_p_nz(cpu, cpu->x);
+            return 2;
+        case 0xA6: // LDX zp
+            cpu->x = mem_read(cpu, operand);
+            apply_p_nz(cpu, cpu->x);
+            return 3;
+        case 0xB6: // LDX zp,Y
+            addr = (uint8_t)(operand + cpu->y);
+            cpu->x = mem_read(cpu, addr);
+            apply_p_nz(cpu, cpu->x);
+            return 4;
+        case 0xAE: // LDX abs
+            cpu->x = mem_read(cpu, operand);
+            apply_p_nz(cpu, cpu->x);
+            return 4;
+        case 0xBE: // LDX abs,Y
+            addr = operand + cpu->y;
+            cpu->x = mem_read(cpu, addr);
+            apply_p_nz(cpu, cpu->x);
+            return 4 + apply_page_boundary_penalty(operand, addr);
+        case 0xA0: // LDY #
+            cpu->y = operand;
+            apply_p_nz(cpu, cpu->y);
+            return 2;
+        case 0xA4: // LDY zp
+            cpu->y = mem_read(cpu, operand);
+            apply_p_nz(cpu, cpu->y);
+            return 3;
+        case 0xB4: // LDY zp,X
+            addr = (uint8_t)(operand + cpu->x);
+            cpu->y = mem_read(cpu, addr);
+            apply_p_nz(cpu, cpu->y);
+            return 4;
+        case 0xAC: // LDY abs
+            cpu->y = mem_read(cpu, operand);
+            apply_p_nz(cpu, cpu->y);
+            return 4;
+        case 0xBC: // LDY abs,X
+            addr = operand + cpu->x;
+            cpu->y = mem_read(cpu, addr);
+            apply_p_nz(cpu, cpu->y);
+            return 4 + apply_page_boundary_penalty(operand, addr);
+        case 0x85: // STA zp
+            mem_write(cpu, operand, cpu->a);
+            return 3;
+        case 0x95: // STA zp,X
+            addr = (uint8_t)(operand + cpu->x);
+            mem_write(cpu, addr, cpu->a);
+            return 4;
+        case 0x8D: // STA abs
+            mem_write(cpu, operand, cpu->a);
+            return 4;
+        case 0x9D: // STA abs,X
+            addr = operand + cpu->x;
+            mem_write(cpu, addr, cpu->a);
+            return 5;
+        case 0x99: // STA abs,Y
+            addr = operand + cpu->y;
+            mem_write(cpu, addr, cpu->a);
+            return 5;
+        case 0x81: // STA (zp,X)
+            addr = mem_read_word(cpu, (uint8_t)(operand + cpu->x));
+            mem_write(cpu, addr, cpu->a);
+            return 6;
+        case 0x91: // STA (zp),Y
+            addr = mem_read_word(cpu, operand) + cpu->y;
+            mem_write(cpu, addr, cpu->a);
+            return 6;
+        case 0x86: // STX zp
+            mem_write(cpu, operand, cpu->x);
+            return 3;
+        case 0x96: // STX zp,Y
+            addr = (uint8_t)(operand + cpu->y);
+            mem_write(cpu, addr, cpu->x);
+            return 4;
+        case 0x8E: // STX abs
+            mem_write(cpu, operand, cpu->x);
+            return 4;
+        case 0x84: // STY zp
+            mem_write(cpu, operand, cpu->y);
+            return 3;
+        case 0x94: // STY zp,X
+            addr = (uint8_t)(operand + cpu->x);
+            mem_write(cpu, addr, cpu->y);
+            return 4;
+        case 0x8C: // STY abs
+            mem_write(cpu, operand, cpu->y);
+            return 4;
+        case 0x48: // PHA
+            stack_push(cpu, cpu->a);
+            return 3;
+        case 0x08: // PHP
+            stack_push(cpu, get_p(cpu) | P_B | P__);
+            return 3;
+        case 0x68: // PLA
+            cpu->a = stack_pull(cpu);
+            apply_p_nz(cpu, cpu->a);
+            return 4;
+        case 0x28: // PLP
+            set_p(cpu, stack_pull(cpu) & ~(P_B | P__));
+            return 4;
+        case 0x69: // ADC #
+            alu_adc(cpu, operand);
+            return 2;
+        case 0x65: // ADC zp
+            alu_adc(cpu, mem_read(cpu, operand));
+            return 3;
+        case 0x75: // ADC zp,X
+            addr = (uint8_t)(operand + cpu->x);
+            alu_adc(cpu, mem_read(cpu, addr));
+            return 4;
+        case 0x6D: // ADC abs
+            alu_adc(cpu, mem_read(cpu, operand));
+            return 4;
+        case 0x7D: // ADC abs,X
+            addr = operand + cpu->x;
+            alu_adc(cpu, mem_read(cpu, addr));
+            return 4 + apply_page_boundary_penalty(operand, addr);
+        case 0x79: // ADC abs,Y
+            addr = operand + cpu->y;
+            alu_adc(cpu, mem_read(cpu, addr));
+            return 4 + apply_page_boundary_penalty(operand, addr);
+        case 0x61: // ADC (zp,X)
+            addr = mem_read_word(cpu, (uint8_t)(operand + cpu->x));
+            alu_adc(cpu, mem_read(cpu, addr));
+            return 6;
+        case 0x71: // ADC (zp),Y
+            addr = mem_read_word(cpu, operand) + cpu->y;
+            alu_adc(cpu, mem_read(cpu, addr));
+            return 5 + apply_page_boundary_penalty(operand, addr);
+        case 0xE9: // SBC #
+            alu_sbc(cpu, operand);
+            return 2;
+        case 0xE5: // SBC zp
+            alu_sbc(cpu, mem_read(cpu, operand));
+            return 3;
+        case 0xF5: // SBC zp,X
+            addr = (uint8_t)(operand + cpu->x);
+            alu_sbc(cpu, mem_read(cpu, addr));
+            return 4;
+        case 0xED: // SBC abs
+            alu_sbc(cpu, mem_read(cpu, operand));
+            return 4;
+        case 0xFD: // SBC abs,X
+            addr = operand + cpu->x;
+            alu_sbc(cpu, mem_read(cpu, addr));
+            return 4 + apply_page_boundary_penalty(operand, addr);
+        case 0xF9: // SBC abs,Y
+            addr = operand + cpu->y;
+            alu_sbc(cpu, mem_read(cpu, addr));
+            return 4 + apply_page_boundary_penalty(operand, addr);
+        case 0xE1: // SBC (zp,X)
+            addr = mem_read_word(cpu, (uint8_t)(operand + cpu->x));
+            alu_sbc(cpu, mem_read(cpu, addr));
+            return 6;
+        case 0xF1: // SBC (zp),Y
+            addr = mem_read_word(cpu, operand) + cpu->y;
+            alu_sbc(cpu, mem_read(cpu, addr));
+            return 5 + apply_page_boundary_penalty(operand, addr);
+        case 0x29: // AND #
+            cpu->a &= operand;
+            apply_p_nz(cpu, cpu->a);
+            return 2;
+        case 0x25: // AND zp
+            cpu->a &= mem_read(cpu, operand);
+            apply_p_nz(cpu, cpu->a);
+            return 3;
+        case 0x35: // AND zp,X
+            addr = (uint8_t)(operand + cpu->x);
+            cpu->a &= mem_read(cpu, addr);
+            apply_p_nz(cpu, cpu->a);
+            return 4;
+        case 0x2D: // AND abs
+            cpu->a &= mem_read(cpu, operand);
+            apply_p_nz(cpu, cpu->a);
+            return 4;
+        case 0x3D: // AND abs,X
+            addr = operand + cpu->x;
+            cpu->a &= mem_read(cpu, addr);
+            apply_p_nz(cpu, cpu->a);
+            return 4 + apply_page_boundary_penalty(operand, addr);
+        case 0x39: // AND abs,Y
+            addr = operand + cpu->y;
+            cpu->a &= mem_read(cpu, addr);
+            apply_p_nz(cpu, cpu->a);
+            return 4 + apply_page_boundary_penalty(operand, addr);
+        case 0x21: // AND (zp,X)
+            addr = mem_read_word(cpu, (uint8_t)(operand + cpu->x));
+            cpu->a &= mem_read(cpu, addr);
+            apply_p_nz(cpu, cpu->a);
+            return 6;
+        case 0x31: // AND (zp),Y
+            addr = mem_read_word(cpu, operand) + cpu->y;
+            cpu->a &= mem_read(cpu, addr);
+            apply_p_nz(cpu, cpu->a);
+            return 5 + apply_page_boundary_penalty(operand, addr);
+        case 0x49: // EOR #
+            cpu->a ^= operand;
+            apply_p_nz(cpu, cpu->a);
+            return 2;
+        case 0x45: // EOR zp
+            cpu->a ^= mem_read(cpu, operand);
+            apply_p_nz(cpu, cpu->a);
+            return 3;
+        case 0x55: // EOR zp,X
+            addr = (uint8_t)(operand + cpu->x);
+            cpu->a ^= mem_read(cpu, addr);
+            apply_p_nz(cpu, cpu->a);
+            return 4;
+        case 0x4D: // EOR abs
+            cpu->a ^= mem_read(cpu, operand);
+            apply_p_nz(cpu, cpu->a);
+            return 4;
+        case 0x5D: // EOR abs,X
+            addr = operand + cpu->x;
+            cpu->a ^= mem_read(cpu, addr);
+            apply_p_nz(cpu, cpu->a);
+            return 4 + apply_page_boundary_penalty(operand, addr);
+        case 0x59: // EOR abs,Y
+            addr = operand + cpu->y;
+            cpu->a ^= mem_read(cpu, addr);
+            apply_p_nz(cpu, cpu->a);
+            return 4 + apply_page_boundary_penalty(operand, addr);
+        case 0x41: // EOR (zp,X)
+            addr = mem_read_word(cpu, (uint8_t)(operand + cpu->x));
+            cpu->a ^= mem_read(cpu, addr);
+            apply_p_nz(cpu, cpu->a);
+            return 6;
+        case 0x51: // EOR (zp),Y
+            addr = mem_read_word(cpu, operand) + cpu->y;
+            cpu->a ^= mem_read(cpu, addr);
+            apply_p_nz(cpu, cpu->a);
+            return 5 + apply_page_boundary_penalty(operand, addr);
+        case 0x09: // ORA #
+            cpu->a |= operand;
+            apply_p_nz(cpu, cpu->a);
+            return 2;
+        case 0x05: // ORA zp
+            cpu->a |= mem_read(cpu, operand);
+            apply_p_nz(cpu, cpu->a);
+            return 3;
+        case 0x15: // ORA zp,X
+            addr = (uint8_t)(operand + cpu->x);
+            cpu->a |= mem_read(cpu, addr);
+            apply_p_nz(cpu, cpu->a);
+            return 4;
+        case 0x0D: // ORA abs
+            cpu->a |= mem_read(cpu, operand);
+            apply_p_nz(cpu, cpu->a);
+            return 4;
+        case 0x1D: // ORA abs,X
+            addr = operand + cpu->x;
+            cpu->a |= mem_read(cpu, addr);
+            apply_p_nz(cpu, cpu->a);
+            return 4 + apply_page_boundary_penalty(operand, addr);
+        case 0x19: // ORA abs,Y
+            addr = operand + cpu->y;
+            cpu->a |= mem_read(cpu, addr);
+            apply_p_nz(cpu, cpu->a);
+            return 4 + apply_page_boundary_penalty(operand, addr);
+        case 0x01: // ORA (zp,X)
+            addr = mem_read_word(cpu, (uint8_t)(operand + cpu->x));
+            cpu->a |= mem_read(cpu, addr);
+            apply_p_nz(cpu, cpu->a);
+            return 6;
+        case 0x11: // ORA (zp),Y
+            addr = mem_read_word(cpu, operand) + cpu->y;
+            cpu->a |= mem_read(cpu, addr);
+            apply_p_nz(cpu, cpu->a);
+            return 5 + apply_page_boundary_penalty(operand, addr);
+        case 0xC9: // CMP #
+            alu_cmp(cpu, cpu->a, operand);
+            return 2;
+        case 0xC5: // CMP zp
+            alu_cmp(cpu, cpu->a, mem_read(cpu, operand));
+            return 3;
+        case 0xD5: // CMP zp,X
+            addr = (uint8_t)(operand + cpu->x);
+            alu_cmp(cpu, cpu->a, mem_read(cpu, addr));
+            return 4;
+        case 0xCD: // CMP abs
+            alu_cmp(cpu, cpu->a, mem_read(cpu, operand));
+            return 4;
+        case 0xDD: // CMP abs,X
+            addr = operand + cpu->x;
+            alu_cmp(cpu, cpu->a, mem_read(cpu, addr));
+            return 4 + apply_page_boundary_penalty(operand, addr);
+        case 0xD9: // CMP abs,Y
+            addr = operand + cpu->y;
+            alu_cmp(cpu, cpu->a, mem_read(cpu, addr));
+            return 4 + apply_page_boundary_penalty(operand, addr);
+        case 0xC1: // CMP (zp,X)
+            addr = mem_read_word(cpu, (uint8_t)(operand + cpu->x));
+            alu_cmp(cpu, cpu->a, mem_read(cpu, addr));
+            return 6;
+        case 0xD1: // CMP (zp),Y
+            addr = mem_read_word(cpu, operand) + cpu->y;
+            alu_cmp(cpu, cpu->a, mem_read(cpu, addr));
+            return 5 + apply_page_boundary_penalty(operand, addr);
+        case 0xE0: // CPX #
+            alu_cmp(cpu, cpu->x, operand);
+            return 2;
+        case 0xE4: // CPX zp
+            alu_cmp(cpu, cpu->x, mem_read(cpu, operand));
+            return 3;
+        case 0xEC: // CPX abs
+            alu_cmp(cpu, cpu->x, mem_read(cpu, operand));
+            return 4;
+        case 0xC0: // CPY #
+            alu_cmp(cpu, cpu->y, operand);
+            return 2;
+        case 0xC4: // CPY zp
+            alu_cmp(cpu, cpu->y, mem_read(cpu, operand));
+            return 3;
+        case 0xCC: // CPY abs
+            alu_cmp(cpu, cpu->y, mem_read(cpu, operand));
+            return 4;
+        case 0x24: // BIT zp
+            alu_bit(cpu, mem_read(cpu, operand));
+            return 3;
+        case 0x2C: // BIT abs
+            alu_bit(cpu, mem_read(cpu, operand));
+            return 4;
+        case 0xE6: // INC zp
+            value = mem_read(cpu, operand) + 1;
+            mem_write(cpu, operand, value);
+            apply_p_nz(cpu, value);
+            return 5;
+        case 0xF6: // INC zp,X
+            addr = (uint8_t)(operand + cpu->x);
+            value = mem_read(cpu, addr) + 1;
+            mem_write(cpu, addr, value);
+            apply_p_nz(cpu, value);
+            return 6;
+        case 0xEE: // INC abs
+            value = mem_read(cpu, operand) + 1;
+            mem_write(cpu, operand, value);
+            apply_p_nz(cpu, value);
+            return 6;
+        case 0xFE: // INC abs,X
+            addr = operand + cpu->x;
+            value = mem_read(cpu, addr) + 1;
+            mem_write(cpu, addr, value);
+            apply_p_nz(cpu, value);
+            return 7;
+        case 0xE8: // INX
+            apply_p_nz(cpu, ++cpu->x);
+            return 2;
+        case 0xC8: // INY
+            apply_p_nz(cpu, ++cpu->y);
+            return 2;
+        case 0xC6: // DEC zp
+            value = mem_read(cpu, operand) - 1;
+            mem_write(cpu, operand, value);
+            apply_p_nz(cpu, value);
+            return 5;
+        case 0xD6: // DEC zp,X
+            addr = (uint8_t)(operand + cpu->x);
+            value = mem_read(cpu, addr) - 1;
+            mem_write(cpu, addr, value);
+            apply_p_nz(cpu, value);
+            return 6;
+        case 0xCE: // DEC abs
+            value = mem_read(cpu, operand) - 1;
+            mem_write(cpu, operand, value);
+            apply_p_nz(cpu, value);
+            return 6;
+        case 0xDE: // DEC abs,X
+            addr = operand + cpu->x;
+            value = mem_read(cpu, addr) - 1;
+            mem_write(cpu, addr, value);
+            apply_p_nz(cpu, value);
+            return 7;
+        case 0xCA: // DEX
+            apply_p_nz(cpu, --cpu->x);
+            return 2;
+        case 0x88: // DEY
+            apply_p_nz(cpu, --cpu->y);
+            return 2;
+        case 0x0A: // ASL
+            cpu->a = alu_asl(cpu, cpu->a);
+            return 2;
+        case 0x06: // ASL zp
+            mem_write(cpu, operand, alu_asl(cpu, mem_read(cpu, operand)));
+            return 5;
+        case 0x16: // ASL zp,X
+            addr = (uint8_t)(operand + cpu->x);
+            mem_write(cpu, addr, alu_asl(cpu, mem_read(cpu, addr)));
+            return 6;
+        case 0x0E: // ASL abs
+            mem_write(cpu, operand, alu_asl(cpu, mem_read(cpu, operand)));
+            return 6;
+        case 0x1E: // ASL abs,X
+            addr = operand + cpu->x;
+            mem_write(cpu, addr, alu_asl(cpu, mem_read(cpu, addr)));
+            return 7;
+        case 0x4A: // LSR
+            cpu->a = alu_lsr(cpu, cpu->a);
+            return 2;
+        case 0x46: // LSR zp
+            mem_write(cpu, operand, alu_lsr(cpu, mem_read(cpu, operand)));
+            return 5;
+        case 0x56: // LSR zp,X
+            addr = (uint8_t)(operand + cpu->x);
+            mem_write(cpu, addr, alu_lsr(cpu, mem_read(cpu, addr)));
+            return 6;
+        case 0x4E: // LSR abs
+            mem_write(cpu, operand, alu_lsr(cpu, mem_read(cpu, operand)));
+            return 6;
+        case 0x5E: // LSR abs,X
+            addr = operand + cpu->x;
+            mem_write(cpu, addr, alu_lsr(cpu, mem_read(cpu, addr)));
+            return 7;
+        case 0x2A: // ROL
+            cpu->a = alu_rol(cpu, cpu->a);
+            return 2;
+        case 0x26: // ROL zp
+            mem_write(cpu, operand, alu_rol(cpu, mem_read(cpu, operand)));
+            return 5;
+        case 0x36: // ROL zp,X
+            addr = (uint8_t)(operand + cpu->x);
+            mem_write(cpu, addr, alu_rol(cpu, mem_read(cpu, addr)));
+            return 6;
+        case 0x2E: // ROL abs
+            mem_write(cpu, operand, alu_rol(cpu, mem_read(cpu, operand)));
+            return 6;
+        case 0x3E: // ROL abs,X
+            addr = operand + cpu->x;
+            mem_write(cpu, addr, alu_rol(cpu, mem_read(cpu, addr)));
+            return 7;
+        case 0x6A: // ROR
+            cpu->a = alu_ror(cpu, cpu->a);
+            return 2;
+        case 0x66: // ROR zp
+            mem_write(cpu, operand, alu_ror(cpu, mem_read(cpu, operand)));
+            return 5;
+        case 0x76: // ROR zp,X
+            addr = (uint8_t)(operand + cpu->x);
+            mem_write(cpu, addr, alu_ror(cpu, mem_read(cpu, addr)));
+            return 6;
+        case 0x6E: // ROR abs
+            mem_write(cpu, operand, alu_ror(cpu, mem_read(cpu, operand)));
+            return 6;
+        case 0x7E: // ROR abs,X
+            addr = operand + cpu->x;
+            mem_write(cpu, addr, alu_ror(cpu, mem_read(cpu, addr)));
+            return 7;
+        case 0x4C: // JMP abs
+            cpu->pc = operand;
+            return 3;
+        case 0x6C: // JMP (abs)
+            cpu->pc = mem_read_word(cpu, operand);
+            return 5;
+        case 0x20: // JSR abs
+            stack_push_word(cpu, cpu->pc - 1);
+            cpu->pc = operand;
+            return 6;
+        case 0x40: // RTI
+            set_p(cpu, stack_pull(cpu) & ~(P_B | P__));
+            cpu->pc = stack_pull_word(cpu);
+            return 6;
+        case 0x60: // RTS
+            cpu->pc = stack_pull_word(cpu) + 1;
+            return 6;
+        case 0x10: // BPL
+            return 2 + branch(cpu, operand, P_N, false);
+        case 0x30: // BMI
+            return 2 + branch(cpu, operand, P_N, true);
+        case 0x50: // BVC
+            return 2 + branch(cpu, operand, P_V, false);
+        case 0x70: // BVS
+            return 2 + branch(cpu, operand, P_V, true);
+        case 0x90: // BCC
+            return 2 + branch(cpu, operand, P_C, false);
+        case 0xB0: // BCS
+            return 2 + branch(cpu, operand, P_C, true);
+        case 0xD0: // BNE
+            return 2 + branch(cpu, operand, P_Z, false);
+        case 0xF0: // BEQ
+            return 2 + branch(cpu, operand, P_Z, true);
+        case 0x00: // BRK
+            cpu->pc++;
+            return interrupt(cpu, true, IVT_IRQ);
+        case 0x18: // CLC
+            set_p_flag(cpu, P_C, false);
+            return 2;
+        case 0x58: // CLI
+            set_p_flag(cpu, P_I, false);
+            return 2;
+        case 0xD8: // CLD
+            set_p_flag(cpu, P_D, false);
+            return 2;
+        case 0xB8: // CLV
+            set_p_flag(cpu, P_V, false);
+            return 2;
+        case 0x38: // SEC
+            set_p_flag(cpu, P_C, true);
+            return 2;
+        case 0x78: // SEI
+            set_p_flag(cpu, P_I, true);
+            return 2;
+        case 0xF8: // SED
+            set_p_flag(cpu, P_D, true);
+            return 2;
+        case 0xEA: // NOP
+            return 2;
+        default: // KIL
+            return 1;
+    }
+}
+
+// FUSED SEQUENCES //
+
+static const struct {
+    Fusion fusion;
+    int length;
+    uint8_t insts[3][3]; // Up to 3 alternatives for each instruction
+} fusions[] = {
+    {FUSION_LDA_STA,     2, {{0xA9, 0xA5, 0xAD}, {0x85, 0x8D}}},
+    {FUSION_DEX_BNE,     2, {{0xCA},             {0xD0}}},
+    {FUSION_DEY_BNE,     2, {{0x88},             {0xD0}}},
+    {FUSION_INX_CPX_BNE, 3, {{0xE8},             {0xE0}, {0xD0}}},
+    {FUSION_INY_CPY_BNE, 3, {{0xC8},             {0xC0}, {0xD0}}},
+    {FUSION_LDA_CMP_BEQ, 3, {{0xA5},             {0xC9}, {0xF0}}},
+    {FUSION_CLC_ADC,     2, {{0x18},             {0x69, 0x65, 0x6D}}},
+};
+static const int fusions_len = sizeof(fusions) / sizeof(fusions[0]);
+
+static bool is_any_of(const uint8_t insts[3], uint8_t inst) {
+    for (int i = 0; i < 3 && insts[i]; i++) {
+        if (insts[i] == inst) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static Fusion detect_fusion(const CPU65xxDecoded *page, int offset) {
+    Fusion result = FUSION_NONE;
+    for (int f = 0; f < fusions_len; f++) {
+        int o = offset;
+        int i = 0;
+        while (i < fusions[f].length && o <= MASK_DECODED_PAGE &&
+               page[o].size && is_any_of(fusions[f].insts[i], page[o].inst)) {
+            o += page[o].size;
+            i++;
+        }
+        if (i == fusions[f].length) {
+            return fusions[f].fusion;
+        }
+        // Partial match, retry once the rest has been decoded
+        if (i && o <= MASK_DECODED_PAGE && !page[o].size) {
+            result = FUSION_UNKNOWN;
+        }
+    }
+    return result;
+}
+
+// Cycles of an immediate, zero page or absolute read/write instruction
+static inline int fused_cycles(const CPU65xxDecoded *decoded) {
+    if (decoded->size == 3) {
+        return 4;
+    }
+    return ((decoded->inst & 0x0F) == 0x09 ? 2 : 3);
+}
+
+static inline uint8_t fused_read(CPU65xx *cpu, const CPU65xxDecoded *decoded) {
+    *cpu->open_bus = decoded->bus;
+    if ((decoded->inst & 0x0F) == 0x09) {
+        return decoded->operand;
+    }
+    return mem_read(cpu, decoded->operand);
+}
+
+// Runs the fused sequence at pc if there is one and all of its instructions
+// start within budget cycles, returns 0 otherwise
+static int step_fused(CPU65xx *cpu, int budget) {
+    CPU65xxDecoded *page = cpu->decoded[cpu->pc >> DECODED_PAGE_SHIFT];
+    if (!page) {
+        return 0;
+    }
+    CPU65xxDecoded *d1 = page + (cpu->pc & MASK_DECODED_PAGE);
+    if (!d1->size) {
+        return 0;
+    }
+    if (d1->fusion == FUSION_UNKNOWN) {
+        d1->fusion = detect_fusion(page, cpu->pc & MASK_DECODED_PAGE);
+    }
+    if (d1->fusion <= FUSION_NONE) {
+        return 0;
+    }
+    const CPU65xxDecoded *d2 = d1 + d1->size;
+    const CPU65xxDecoded *d3;
+    
+    int t;
+    switch ((Fusion)d1->fusion) {
+        case FUSION_LDA_STA:
+            t = fused_cycles(d1);
+            if (t > budget) {
+                return 0;
+            }
+            cpu->pc += d1->size + d2->size;
+            cpu->a = fused_read(cpu, d1);
+            apply_p_nz(cpu, cpu->a);
+            *cpu->open_bus = d2->bus;
+            mem_write(cpu, d2->operand, cpu->a);
+            return t + fused_cycles(d2);
+        case FUSION_DEX_BNE:
+        case FUSION_DEY_BNE:
+            if (budget < 2) {
+                return 0;
+            }
+            cpu->pc += 3;
+            *cpu->open_bus = d2->bus;
+            if (d1->fusion == FUSION_DEX_BNE) {
+                apply_p_nz(cpu, --cpu->x);
+            } else {
+                apply_p_nz(cpu, --cpu->y);
+            }
+            return 4 + branch(cpu, d2->operand, P_Z, false);
+        case FUSION_INX_CPX_BNE:
+        case FUSION_INY_CPY_BNE:
+            if (budget < 4) {
+                return 0;
+            }
+            d3 = d2 + d2->size;
+            cpu->pc += 5;
+            *cpu->open_bus = d3->bus;
+            if (d1->fusion == FUSION_INX_CPX_BNE) {
+                alu_cmp(cpu, ++cpu->x, d2->operand);
+            } else {
+                alu_cmp(cpu, ++cpu->y, d2->operand);
+            }
+            return 6 + branch(cpu, d3->operand, P_Z, false);
+        case FUSION_LDA_CMP_BEQ:
+            if (budget < 5) {
+                return 0;
+            }
+            d3 = d2 + d2->size;
+            cpu->pc += 6;
+            cpu->a = fused_read(cpu, d1);
+            alu_cmp(cpu, cpu->a, d2->operand);
+            *cpu->open_bus = d3->bus;
+            return 7 + branch(cpu, d3->operand, P_Z, true);
+        case FUSION_CLC_ADC:
+            if (budget < 2) {
+                return 0;
+            }
+            cpu->pc += 1 + d2->size;
+            set_p_flag(cpu, P_C, false);
+            alu_adc(cpu, fused_read(cpu, d2));
+            return 2 + fused_cycles(d2);
+        default:
+            return 0;
+    }
+}
+
+// BLOCK EXECUTION //
+
+// Writes are never done before an access that exits the block, and the
+// open bus value gets fetched again, so the registers are all there is to
+// roll back
+typedef struct BlockState {
+    uint8_t a, x, y, s, p, c;
+    uint16_t nz;
+    bool v;
+    uint16_t pc;
+} BlockState;
+
+static void block_save(CPU65xx *cpu, BlockState *state) {
+    *state = (BlockState){cpu->a, cpu->x, cpu->y, cpu->s, cpu->p, cpu->c,
+                          cpu->nz, cpu->v, cpu->pc};
+}
+
+static bool block_state_equals(const BlockState *a, const BlockState *b) {
+    return a->a == b->a && a->x == b->x && a->y == b->y && a->s == b->s &&
+           a->p == b->p && a->c == b->c && a->nz == b->nz && a->v == b->v &&
+           a->pc == b->pc;
+}
+
+static void block_restore(CPU65xx *cpu, const BlockState *state) {
+    cpu->a = state->a;
+    cpu->x = state->x;
+    cpu->y = state->y;
+    cpu->s = state->s;
+    cpu->p = state->p;
+    cpu->c = state->c;
+    cpu->nz = state->nz;
+    cpu->v = state->v;
+    cpu->pc = state->pc;
+}
+
 // PUBLIC FUNCTIONS //
 
 void cpu_65xx_init(CPU65xx *cpu, void *mm, CPU65xxReadFuncPtr read_func,
                                            CPU65xxWriteFuncPtr write_func) {
     cpu->a = cpu->x = cpu->y = cpu->s = 0;
-    cpu->p = P__;
+    set_p(cpu, P__);
     cpu->pc = 0;
     
     cpu->mm = mm;
     cpu->read_func = read_func;
     cpu->write_func = write_func;
+    for (int i = 0; i < DECODED_PAGES; i++) {
+        cpu->decoded[i] = NULL;
+    }
+    cpu->open_bus = NULL;
+    cpu->engine = ENGINE_BLOCK;
+    memset(cpu->block_access, 0, sizeof(cpu->block_access));
+    cpu->in_block = cpu->block_exit = false;
+    cpu->block_writes = 0;
+    cpu->block_irq = true;
+    cpu->block_poll_mask = cpu->block_poll_addr = 0;
+    cpu->block_poll = false;
     
     // Initialize opcode lookup to KIL instruction
     // TODO: Add more illegal opcodes
@@ -546,22 +1490,12 @@ void cpu_65xx_init(CPU65xx *cpu, void *mm, CPU65xxReadFuncPtr read_func,
     cpu->opcodes[0xEA] = (Opcode) {"NOP", 0, 0, 2, op_NOP, AM_IMPLIED};
 }
 
-int cpu_65xx_step(CPU65xx *cpu, bool verbose) {
-    if (verbose) {
-        printf("$%04x ", cpu->pc);
-    }
-    
+static int step_reference(CPU65xx *cpu) {
     if (cpu->nmi) {
         cpu->nmi = false;
-        if (verbose) {
-            printf("/NMI\n");
-        }
         return interrupt(cpu, false, IVT_NMI);
     }
     if (cpu->irq && !get_p_flag(cpu, P_I)) {
-        if (verbose) {
-            printf("/IRQ\n");
-        }
         return interrupt(cpu, false, IVT_IRQ);
     }
     
@@ -613,43 +1547,6 @@ int cpu_65xx_step(CPU65xx *cpu, bool verbose) {
             break;
     }
     
-    if (verbose) {
-        printf("%s", op->name);
-        switch (op->am) {
-            case AM_IMPLIED:
-                break;
-            case AM_IMMEDIATE:
-                printf(" #$%02x", p1.immediate_value);
-                break;
-            case AM_ZP:
-                printf(" $%02x", p1.immediate_value);
-                break;
-            case AM_ABSOLUTE:
-                printf(" $%04x", p1.addr);
-                break;
-            case AM_INDIRECT_WORD:
-                printf(" ($%04x)", p1.addr);
-                break;
-            case AM_INDIRECT_X:
-                printf(" ($%02x,X)", p1.immediate_value);
-                break;
-            case AM_INDIRECT_Y:
-                printf(" ($%02x),Y", p1.immediate_value);
-                break;
-            case AM_RELATIVE:
-                printf(" %+d", p1.relative_addr);
-                break;
-        }
-        if (op->am == AM_ZP || op->am == AM_ABSOLUTE) {
-            if (op->reg2 == &cpu->x) {
-                printf(",X");
-            } else if (op->reg2 == &cpu->y) {
-                printf(",Y");
-            }
-        }
-        printf("\n");
-    }
-    
     // And finally, run the instruction
     int t = abs(op->cycles) + (*op->func)(cpu, op, p2);
     if (op->cycles < 0) {
@@ -658,18 +1555,146 @@ int cpu_65xx_step(CPU65xx *cpu, bool verbose) {
     return t;
 }
 
-int cpu_65xx_reset(CPU65xx *cpu, bool verbose) {
-    if (verbose) {
-        printf("$%04x /RESET", cpu->pc);
+int cpu_65xx_step(CPU65xx *cpu) {
+    if (cpu->engine != ENGINE_REFERENCE) {
+        return step_specialized(cpu);
     }
+    return step_reference(cpu);
+}
+
+// Runs one instruction, then keeps going for as long as the following ones
+// only touch BlockAccess memory and start within max_cycles, as nothing
+// else in the system can observe them. Returns the total cycle count.
+int cpu_65xx_run(CPU65xx *cpu, int max_cycles) {
+    int t = cpu_65xx_step(cpu);
+    if (cpu->engine != ENGINE_BLOCK) {
+        return t;
+    }
+    
+    cpu->in_block = true;
+    cpu->block_writes = 0;
+    BlockState loop = {0};
+    int loop_t = -1;
+    unsigned int loop_writes = 0;
+    // Interrupts must not be able to occur in the middle of a block
+    while (t <= max_cycles && !cpu->nmi &&
+           (get_p_flag(cpu, P_I) || (!cpu->irq && !cpu->block_irq))) {
+        BlockState saved;
+        block_save(cpu, &saved);
+        int step_t = step_fused(cpu, max_cycles - t);
+        if (!step_t) {
+            step_t = step_specialized(cpu);
+        }
+        if (cpu->block_exit) {
+            // Roll back, the instruction will run at its proper time
+            block_restore(cpu, &saved);
+            cpu->block_exit = false;
+            break;
+        }
+        t += step_t;
+        
+        // Check backward jumps for idle loops: with the same state and no
+        // writes since the last pass, every pass until the horizon will be
+        // identical, so they can be skipped while keeping their cycles
+        if (cpu->pc > saved.pc) {
+            continue;
+        }
+        BlockState current;
+        block_save(cpu, &current);
+        if (loop_t >= 0 && cpu->block_writes == loop_writes &&
+            block_state_equals(&current, &loop)) {
+            const int period = t - loop_t;
+            if (t <= max_cycles) {
+                t += (max_cycles - t) / period * period;
+            }
+            loop_t = -1;
+        } else {
+            loop = current;
+            loop_t = t;
+            loop_writes = cpu->block_writes;
+        }
+    }
+    cpu->in_block = false;
+    return t;
+}
+
+int cpu_65xx_reset(CPU65xx *cpu) {
     return interrupt(cpu, true, IVT_RESET);
 }
 
+uint8_t cpu_65xx_get_p(CPU65xx *cpu) {
+    return get_p(cpu);
+}
+
+int cpu_65xx_decode(CPU65xxDecoded *decoded, const uint8_t *code, int len) {
+    const uint8_t size = op_sizes[code[0]];
+    // Same bytes as fetch() reads, including the dummy read
+    if ((size > 2 ? size : 2) > len) {
+        return 0;
+    }
+    decoded->inst = code[0];
+    decoded->size = size;
+    decoded->operand = (size == 3 ? code[1] | code[2] << 8 :
+                        size == 2 ? code[1] : 0);
+    decoded->bus = code[size == 3 ? 2 : 1];
+    decoded->fusion = FUSION_UNKNOWN;
+    return size;
+}
+
+void cpu_65xx_detect_fusions(CPU65xxDecoded *page) {
+    for (int offset = 0; offset <= MASK_DECODED_PAGE; offset++) {
+        if (page[offset].size) {
+            page[offset].fusion = detect_fusion(page, offset);
+        }
+    }
+}
+
+int cpu_65xx_disassemble(CPU65xx *cpu, char *buf, size_t size,
+                         uint8_t inst, uint16_t operand) {
+    const Opcode *op = &cpu->opcodes[inst];
+    const uint8_t low = operand & 0xFF;
+    int len = snprintf(buf, size, "%s", op->name);
+    switch (op->am) {
+        case AM_IMPLIED:
+            break;
+        case AM_IMMEDIATE:
+            len += snprintf(buf + len, size - len, " #$%02x", low);
+            break;
+        case AM_ZP:
+            len += snprintf(buf + len, size - len, " $%02x", low);
+            break;
+        case AM_ABSOLUTE:
+            len += snprintf(buf + len, size - len, " $%04x", operand);
+            break;
+        case AM_INDIRECT_WORD:
+            len += snprintf(buf + len, size - len, " ($%04x)", operand);
+            break;
+        case AM_INDIRECT_X:
+            len += snprintf(buf + len, size - len, " ($%02x,X)", low);
+            break;
+        case AM_INDIRECT_Y:
+            len += snprintf(buf + len, size - len, " ($%02x),Y", low);
+            break;
+        case AM_RELATIVE:
+            len += snprintf(buf + len, size - len, " %+d", (int8_t)low);
+            break;
+    }
+    if (op->am == AM_ZP || op->am == AM_ABSOLUTE) {
+        if (op->reg2 == &cpu->x) {
+            len += snprintf(buf + len, size - len, ",X");
+        } else if (op->reg2 == &cpu->y) {
+            len += snprintf(buf + len, size - len, ",Y");
+        }
+    }
+    return len;
+}
+
 void cpu_65xx_debug_print_state(CPU65xx *cpu) {
+    const uint8_t p = get_p(cpu);
     printf("PC=%04x A=%02x X=%02x Y=%02x P=%02x[",
-           cpu->pc, cpu->a, cpu->x, cpu->y, cpu->p);
+           cpu->pc, cpu->a, cpu->x, cpu->y, p);
     for (int i = 0; i < 8; i++) {
-        printf("%c", (cpu->p & (1 << i) ? "czidb-vn"[i] : '.'));
+        printf("%c", (p & (1 << i) ? "czidb-vn"[i] : '.'));
     }
     printf("] S=%02x{", cpu->s);
     for (int i = 0xff; i > cpu->s; i--) {
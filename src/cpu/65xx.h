@@ -38,12 +38,39 @@ typedef enum {
     AM_RELATIVE
 } AddressingMode;
 
+// Predecoded instructions, for fetching code from immutable memory (ROM)
+// without going through read_func; one entry per byte of that memory
+#define DECODED_PAGES 8
+#define DECODED_PAGE_SHIFT 13
+#define MASK_DECODED_PAGE ((1 << DECODED_PAGE_SHIFT) - 1)
+
+typedef struct CPU65xxDecoded {
+    uint16_t operand;
+    uint8_t inst;
+    uint8_t size;   // 0 if not decoded yet
+    uint8_t bus;    // Last byte read during the fetch
+    uint8_t fusion; // Sequence starting with this instruction, if any
+} CPU65xxDecoded;
+
 typedef union {
     uint16_t addr;
     uint8_t immediate_value;
     int8_t relative_addr;
 } OpParam;
 
+// Interpreter implementations, all cycle-for-cycle identical
+typedef enum {
+    ENGINE_REFERENCE,   // Generic, table-driven
+    ENGINE_SPECIALIZED, // One switch case per opcode
+    ENGINE_BLOCK        // Specialized, running blocks in cpu_65xx_run()
+} CPU65xxEngine;
+
+// Memory that can be accessed out of lockstep with the rest of the system
+typedef enum {
+    BA_READ  = 1 << 0,
+    BA_WRITE = 1 << 1
+} BlockAccess;
+
 typedef int (*OpcodeFunc)(CPU65xx *, const Opcode *, OpParam);
 
 struct Opcode {
@@ -62,8 +89,12 @@ struct CPU65xx {
     uint8_t y;
     // Stack register
     uint8_t s;
-    // Processor status register
+    // Processor status register, with N, Z, C and V kept apart in the
+    // following fields as they are updated by most instructions
     uint8_t p;
+    uint16_t nz; // Z if the low byte is 0, N if bit 7 or 8 is set
+    uint8_t c;
+    bool v;
     // Program counter
     uint16_t pc;
     // Memory I/O
@@ -73,6 +104,24 @@ struct CPU65xx {
     // Interrupt lines
     bool nmi;
     int irq;
+    // Predecoded instructions for each 8kB page (NULL if not cacheable),
+    // along with the open bus value that the fetch would have left behind
+    CPU65xxDecoded *decoded[DECODED_PAGES];
+    uint8_t *open_bus;
+    // Interpreter to use in cpu_65xx_step() and cpu_65xx_run()
+    CPU65xxEngine engine;
+    // BlockAccess flags for each 256-byte page, and block execution state
+    uint8_t block_access[0x100];
+    bool in_block;
+    bool block_exit;
+    unsigned int block_writes;
+    // Whether the system may raise an IRQ before the horizon
+    bool block_irq;
+    // Register that blocks may also read while block_poll is set, for when
+    // the system knows it to return the same value until the horizon
+    uint16_t block_poll_mask;
+    uint16_t block_poll_addr;
+    bool block_poll;
     // Opcode lookup table
     Opcode opcodes[0x100];
 };
@@ -80,8 +129,23 @@ struct CPU65xx {
 void cpu_65xx_init(CPU65xx *cpu, void *mm, CPU65xxReadFuncPtr read_func,
                                            CPU65xxWriteFuncPtr write_func);
 
-int cpu_65xx_step(CPU65xx *cpu, bool verbose);
-int cpu_65xx_reset(CPU65xx *cpu, bool verbose);
+int cpu_65xx_step(CPU65xx *cpu);
+int cpu_65xx_run(CPU65xx *cpu, int max_cycles);
+int cpu_65xx_reset(CPU65xx *cpu);
+
+uint8_t cpu_65xx_get_p(CPU65xx *cpu);
+
+// Decodes the instruction at the start of len bytes of code, as if fetched
+// from there, returns its size or 0 if it doesn't fit
+int cpu_65xx_decode(CPU65xxDecoded *decoded, const uint8_t *code, int len);
+// Detects the fused sequences starting at every instruction of a whole page
+// of them, as would be done when each first runs in a block
+void cpu_65xx_detect_fusions(CPU65xxDecoded *page);
+
+// Formats an instruction from its opcode and the (little-endian) bytes
+// following it, returns the length as snprintf() would
+int cpu_65xx_disassemble(CPU65xx *cpu, char *buf, size_t size,
+                         uint8_t inst, uint16_t operand);
 
 void cpu_65xx_debug_print_state(CPU65xx *cpu);
 
@@ -0,0 +1,287 @@
+#include "common.h"
+#include <inttypes.h>
+#include <time.h>
+
+#include "driver.h"
+#include "file.h"
+#include "f/loader.h"
+#include "f/machine.h"
+
+// Minimum time spent running the log with each engine, for timing
+#define T_BENCH_MIN 0.5
+
+// Interpreter state before an instruction, from a nestest.log style line:
+// C000  4C F5 C5  JMP $C5F5   A:00 X:00 Y:00 P:24 SP:FD PPU:  0, 21 CYC:7
+typedef struct LogEntry {
+    int line;
+    uint16_t pc;
+    uint8_t a;
+    uint8_t x;
+    uint8_t y;
+    uint8_t p;
+    uint8_t s;
+    uint64_t cycles;
+} LogEntry;
+
+// Power-on state, including the memory the CPU can write to outside of the
+// Machine struct
+typedef struct Snapshot {
+    Machine vm;
+    uint8_t *sram;    // NULL unless the cartridge has SRAM
+    uint8_t *chr_ram; // Same for CHR RAM
+} Snapshot;
+
+typedef struct EngineInfo {
+    CPU65xxEngine engine;
+    const char *name;
+} EngineInfo;
+
+static const EngineInfo engines[] = {
+    {ENGINE_REFERENCE, "reference"},
+    {ENGINE_SPECIALIZED, "specialized"},
+    {ENGINE_BLOCK, "block"},
+};
+
+static double get_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static LogEntry *load_log(const char *path, int *len) {
+    FILE *log_file = fopen(path, "r");
+    if (!log_file) {
+        return NULL;
+    }
+    int cap = 1024;
+    LogEntry *entries = malloc(sizeof(LogEntry) * cap);
+    *len = 0;
+    char line[256];
+    int line_num = 0;
+    while (fgets(line, sizeof(line), log_file)) {
+        line_num++;
+        LogEntry e = {.line = line_num};
+        const char *regs = strstr(line, "A:");
+        const char *cycles = strstr(line, "CYC:");
+        if (sscanf(line, "%4hx", &e.pc) != 1 || !regs || !cycles ||
+            sscanf(regs, "A:%2hhx X:%2hhx Y:%2hhx P:%2hhx SP:%2hhx",
+                   &e.a, &e.x, &e.y, &e.p, &e.s) != 5 ||
+            sscanf(cycles, "CYC:%" SCNu64, &e.cycles) != 1) {
+            continue;
+        }
+        if (*len == cap) {
+            cap *= 2;
+            entries = realloc(entries, sizeof(LogEntry) * cap);
+        }
+        entries[(*len)++] = e;
+    }
+    fclose(log_file);
+    return entries;
+}
+
+static void print_state(const char *prefix, uint16_t pc, uint8_t a, uint8_t x,
+                        uint8_t y, uint8_t p, uint8_t s, uint64_t cycles) {
+    printf("%sPC=%04x A=%02x X=%02x Y=%02x P=%02x S=%02x CYC=%" PRIu64 "\n",
+           prefix, pc, a, x, y, p, s, cycles);
+}
+
+// B only exists on the stack, so it is left out of the comparison
+static bool matches(CPU65xx *cpu, const LogEntry *e, uint64_t cycles) {
+    const uint8_t mask = ~P_B;
+    return cpu->pc == e->pc && cpu->a == e->a && cpu->x == e->x &&
+           cpu->y == e->y && (cpu_65xx_get_p(cpu) & mask) == (e->p & mask) &&
+           cpu->s == e->s && cycles == e->cycles;
+}
+
+static void print_divergence(CPU65xx *cpu, const LogEntry *e,
+                             uint64_t cycles) {
+    printf("  First divergence at log line %d\n", e->line);
+    print_state("    Expected: ", e->pc, e->a, e->x, e->y, e->p, e->s,
+                e->cycles);
+    print_state("    Actual:   ", cpu->pc, cpu->a, cpu->x, cpu->y,
+                cpu_65xx_get_p(cpu) & ~P_B, cpu->s, cycles);
+}
+
+static void snapshot_save(Snapshot *snapshot, const Machine *vm) {
+    const Cartridge *cart = &vm->cart;
+    snapshot->vm = *vm;
+    snapshot->sram = NULL;
+    if (cart->sram.data) {
+        snapshot->sram = malloc(cart->sram.size);
+        memcpy(snapshot->sram, cart->sram.data, cart->sram.size);
+    }
+    snapshot->chr_ram = NULL;
+    if (cart->chr_is_ram) {
+        snapshot->chr_ram = malloc(cart->chr_memory.size);
+        memcpy(snapshot->chr_ram, cart->chr_memory.data,
+               cart->chr_memory.size);
+    }
+}
+
+static void snapshot_restore(const Snapshot *snapshot, Machine *vm) {
+    *vm = snapshot->vm;
+    Cartridge *cart = &vm->cart;
+    if (snapshot->sram) {
+        memcpy(cart->sram.data, snapshot->sram, cart->sram.size);
+    }
+    if (snapshot->chr_ram) {
+        memcpy(cart->chr_memory.data, snapshot->chr_ram,
+               cart->chr_memory.size);
+    }
+}
+
+static void snapshot_teardown(Snapshot *snapshot) {
+    free(snapshot->sram);
+    free(snapshot->chr_ram);
+}
+
+static void reset_cpu(Machine *vm, const Snapshot *snapshot,
+                      CPU65xxEngine engine, const LogEntry *start) {
+    snapshot_restore(snapshot, vm);
+    vm->cpu.engine = engine;
+    vm->cpu.pc = start->pc;
+}
+
+// Steps through the log one instruction at a time, returns how many of
+// them matched before the first divergence
+static int check_stepped(Machine *vm, const LogEntry *entries, int len) {
+    CPU65xx *cpu = &vm->cpu;
+    uint64_t cycles = entries[0].cycles;
+    for (int i = 0; i < len; i++) {
+        if (!matches(cpu, &entries[i], cycles)) {
+            print_divergence(cpu, &entries[i], cycles);
+            return i;
+        }
+        cycles += cpu_65xx_step(cpu);
+    }
+    return len;
+}
+
+// Blocks can't stop on every instruction, so only the state at the end of
+// the log (or the last entry matched by another engine) gets compared
+static int check_block(Machine *vm, const LogEntry *entries, int len) {
+    if (!len) {
+        return 0;
+    }
+    CPU65xx *cpu = &vm->cpu;
+    const LogEntry *last = &entries[len - 1];
+    uint64_t cycles = entries[0].cycles;
+    while (cycles < last->cycles) {
+        cycles += cpu_65xx_run(cpu, (int)(last->cycles - cycles - 1));
+    }
+    if (!matches(cpu, last, cycles)) {
+        print_divergence(cpu, last, cycles);
+        return 0;
+    }
+    return len;
+}
+
+static void run_log(Machine *vm, const LogEntry *entries, int len) {
+    if (vm->cpu.engine == ENGINE_BLOCK) {
+        const uint64_t last_cycles = entries[len - 1].cycles;
+        uint64_t cycles = entries[0].cycles;
+        while (cycles < last_cycles) {
+            cycles += cpu_65xx_run(&vm->cpu, (int)(last_cycles - cycles - 1));
+        }
+    } else {
+        for (int i = 1; i < len; i++) {
+            cpu_65xx_step(&vm->cpu);
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    eprintf("%s-cpucheck build %s (%s)\n", APP_NAME, BUILD_ID, APP_HOMEPAGE);
+    if (argc < 3) {
+        eprintf("Usage: %s rom_file log_file\n", argv[0]);
+        return 1;
+    }
+
+    int len;
+    LogEntry *entries = load_log(argv[2], &len);
+    if (!entries) {
+        eprintf("%s: Error opening file\n", argv[2]);
+        return 1;
+    }
+    if (!len) {
+        eprintf("%s: No instruction found in log\n", argv[2]);
+        return 1;
+    }
+
+    // Load the entire file in memory
+    blob rom;
+    if (!load_file(argv[1], &rom)) {
+        return 1;
+    }
+    if (rom.size < 1024) {
+        eprintf("%s: File is too small\n", argv[1]);
+        return 1;
+    }
+
+    Driver driver;
+    memset(&driver, 0, sizeof(Driver));
+    driver.input.lightgun_pos = -1;
+
+    eprintf("%s: ", argv[1]);
+    if (strncmp((const char *)rom.data, "NES\x1a", 4)) {
+        eprintf("Not an iNES file\n");
+        return 1;
+    }
+    eprintf("iNES file format\n");
+    int error_code = ines_loader(&driver, &rom);
+    if (error_code) {
+        return error_code;
+    }
+    Machine *vm = driver.vm;
+
+    // Every run starts over from the power-on state, only the CPU is run
+    // (starting from the PC of the first entry) so that the logs of CPU
+    // validation ROMs such as nestest can be followed exactly
+    Snapshot *snapshot = malloc(sizeof(Snapshot));
+    snapshot_save(snapshot, vm);
+
+    printf("%s: %d instructions\n", argv[2], len);
+    int matched_max = len;
+    for (size_t i = 0; i < sizeof(engines) / sizeof(EngineInfo); i++) {
+        const EngineInfo *info = &engines[i];
+        printf("%s:\n", info->name);
+
+        reset_cpu(vm, snapshot, info->engine, &entries[0]);
+        const int matched = (info->engine == ENGINE_BLOCK ?
+                             check_block(vm, entries, matched_max) :
+                             check_stepped(vm, entries, len));
+        if (matched < len) {
+            error_code = 1;
+        }
+        if (matched < matched_max) {
+            matched_max = matched;
+        }
+        if (matched < 2) {
+            continue;
+        }
+        printf("  %d instructions match\n", matched);
+
+        // Sustained speed over the part of the log that matched
+        double elapsed = 0.0;
+        uint64_t insts = 0;
+        while (elapsed < T_BENCH_MIN) {
+            reset_cpu(vm, snapshot, info->engine, &entries[0]);
+            const double t_start = get_time();
+            run_log(vm, entries, matched);
+            elapsed += get_time() - t_start;
+            insts += matched - 1;
+        }
+        printf("  %.2f ns/instruction\n", elapsed * 1e9 / insts);
+    }
+
+    snapshot_restore(snapshot, vm);
+    snapshot_teardown(snapshot);
+    free(snapshot);
+    if (driver.teardown_func) {
+        (*driver.teardown_func)(&driver);
+    }
+    free(entries);
+    free(rom.data);
+
+    return error_code;
+}
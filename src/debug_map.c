@@ -0,0 +1,67 @@
+#include "debug_map.h"
+
+static int compare_labels(const void *a, const void *b) {
+    return (int)((const DebugLabel *)a)->addr -
+           (int)((const DebugLabel *)b)->addr;
+}
+
+bool debug_map_load(DebugMap *map, const char *path) {
+    FILE *map_file = fopen(path, "r");
+    if (!map_file) {
+        return false;
+    }
+    int cap = 256;
+    map->labels = malloc(sizeof(DebugLabel) * cap);
+    map->labels_len = 0;
+    // Until sorted, the index of the label right at every address, so that
+    // the last one read for an address replaces the others
+    for (int addr = 0; addr < 0x10000; addr++) {
+        map->closest[addr] = -1;
+    }
+    char name[256];
+    uint16_t addr;
+    while (fscanf(map_file, "%255s @ %4hx", name, &addr) == 2) {
+        DebugLabel *label;
+        if (map->closest[addr] >= 0) {
+            label = &map->labels[map->closest[addr]];
+            free(label->name);
+        } else {
+            if (map->labels_len == cap) {
+                cap *= 2;
+                map->labels = realloc(map->labels, sizeof(DebugLabel) * cap);
+            }
+            map->closest[addr] = map->labels_len;
+            label = &map->labels[map->labels_len++];
+        }
+        *label = (DebugLabel){addr, strdup(name)};
+    }
+    fclose(map_file);
+    qsort(map->labels, map->labels_len, sizeof(DebugLabel), compare_labels);
+
+    int closest = -1;
+    for (int a = 0, i = 0; a < 0x10000; a++) {
+        if (i < map->labels_len && map->labels[i].addr == a) {
+            closest = i++;
+        }
+        map->closest[a] = closest;
+    }
+    return true;
+}
+
+void debug_map_teardown(DebugMap *map) {
+    for (int i = 0; i < map->labels_len; i++) {
+        free(map->labels[i].name);
+    }
+    free(map->labels);
+}
+
+const char *debug_map_get(const DebugMap *map, uint16_t addr) {
+    const int i = map->closest[addr];
+    return (i >= 0 && map->labels[i].addr == addr ? map->labels[i].name :
+            NULL);
+}
+
+const DebugLabel *debug_map_find(const DebugMap *map, uint16_t addr) {
+    const int i = map->closest[addr];
+    return (i >= 0 ? &map->labels[i] : NULL);
+}
@@ -0,0 +1,28 @@
+#ifndef debug_map_h
+#define debug_map_h
+
+#include "common.h"
+
+typedef struct DebugLabel {
+    uint16_t addr;
+    char *name;
+} DebugLabel;
+
+// Labels from a map file with one "name @ addr" per line (addr in hex), as
+// in misc/SMBDIS.map, indexed so that every lookup takes constant time
+typedef struct DebugMap {
+    DebugLabel *labels; // Sorted by address, at most one per address
+    int labels_len;
+    // Index of the closest label at or before every address, or -1
+    int32_t closest[0x10000];
+} DebugMap;
+
+bool debug_map_load(DebugMap *map, const char *path);
+void debug_map_teardown(DebugMap *map);
+
+// Label right at addr, or NULL
+const char *debug_map_get(const DebugMap *map, uint16_t addr);
+// Closest label at or before addr, or NULL
+const DebugLabel *debug_map_find(const DebugMap *map, uint16_t addr);
+
+#endif /* debug_map_h */
@@ -7,16 +7,27 @@
 #define MSG_NONE 0
 #define MSG_TERMINATE 1
 
+typedef struct DebugMap DebugMap;
 typedef struct Driver Driver;
 
-typedef void (*AdvanceFrameFuncPtr)(void *, int, bool);
+// Pixel formats the screens can be rendered in
+typedef enum {
+    SF_ARGB8888 = 0, // 4 bytes per pixel, the default
+    SF_RGB565 = 1,   // 2 bytes per pixel
+    SF_INDEXED = 2,  // 1 byte per pixel, an index into the system palette
+} ScreenFormat;
+
+typedef void (*AdvanceFrameFuncPtr)(void *, int);
 typedef void (*TeardownFuncPtr)(Driver *);
 
 typedef struct Driver {
     void *vm;
+    const DebugMap *dbg_map; // Set before loading, NULL if none
     InputState input;
     uint64_t refresh_rate;
-    uint32_t *screens[2];
+    ScreenFormat screen_format; // Set before loading
+    void *screens[2];
+    size_t screen_size; // Of each of them, in bytes
     int screen_w;
     int screen_h;
     int frame;
@@ -0,0 +1,301 @@
+#include "analysis.h"
+#include <sys/stat.h>
+
+#define HISTORY_LEN 8
+#define JUMP_TABLE_MAX 128
+
+typedef struct Location {
+    uint32_t loc;
+    uint16_t addr;
+} Location;
+
+typedef struct Walker {
+    Machine *vm;
+    CodeAnalysis *ca;
+    const uint8_t *prg;
+    Location *pending;
+    int pending_len;
+    int pending_cap;
+} Walker;
+
+// INSTRUCTIONS //
+
+static bool is_branch(uint8_t inst) {
+    return (inst & 0x1F) == 0x10;
+}
+
+// Decodes the instruction at loc, if it is a legal one fitting in its bank
+static bool decode(Walker *w, uint32_t loc, CPU65xxDecoded *decoded) {
+    if (!cpu_65xx_decode(decoded, w->prg + loc,
+                         SIZE_PRG_BANK - (loc & MASK_PRG_BANK))) {
+        return false;
+    }
+    return strcmp(w->vm->cpu.opcodes[decoded->inst].name, "KIL");
+}
+
+// LOCATIONS //
+
+// Code stays in the same bank within a window, and otherwise goes to the
+// bank mapped at power on, as later bank switches are unknown
+static bool resolve(Walker *w, const Location *from, uint16_t addr,
+                    Location *to) {
+    if (addr < 0x8000) {
+        return false;
+    }
+    if (from && !((from->addr ^ addr) & ~MASK_PRG_BANK)) {
+        to->loc = from->loc - (from->addr & MASK_PRG_BANK) +
+                  (addr & MASK_PRG_BANK);
+    } else {
+        const Cartridge *cart = &w->vm->cart;
+        to->loc = (uint32_t)(cart->prg_banks[(addr >> 13) & (PRG_BANKS - 1)] -
+                             cart->prg_rom.data) + (addr & MASK_PRG_BANK);
+    }
+    to->addr = addr;
+    return true;
+}
+
+static void add_pending(Walker *w, const Location *from, uint16_t addr) {
+    Location to;
+    if (!resolve(w, from, addr, &to)) {
+        return;
+    }
+    if (w->pending_len == w->pending_cap) {
+        w->pending_cap *= 2;
+        w->pending = realloc(w->pending, sizeof(Location) * w->pending_cap);
+    }
+    w->pending[w->pending_len++] = to;
+}
+
+// TRAVERSAL //
+
+// Follows an indirect jump through tables of addresses, when its pointer
+// gets loaded in the usual way right before:
+//     LDA lo_table,X / STA ptr / LDA hi_table,X / STA ptr+1 / JMP (ptr)
+// where the high bytes may also be interleaved with the low bytes
+static void follow_jump_table(Walker *w, const Location *at, uint16_t ptr,
+                              const Location *history, int history_len) {
+    CodeAnalysis *ca = w->ca;
+    uint16_t tables[2];
+    bool found[2] = {false, false};
+    for (int i = 1; i < history_len; i++) {
+        CPU65xxDecoded store, load;
+        decode(w, history[i].loc, &store);
+        decode(w, history[i - 1].loc, &load);
+        if ((store.inst != 0x85 && store.inst != 0x8D) ||
+            (load.inst != 0xBD && load.inst != 0xB9)) {
+            continue;
+        }
+        const uint16_t byte = store.operand - ptr;
+        if (byte < 2) {
+            tables[byte] = load.operand;
+            found[byte] = true;
+        }
+    }
+    if (!found[0] || !found[1]) {
+        return;
+    }
+    const int stride = (tables[1] == tables[0] + 1 ? 2 : 1);
+    for (int i = 0; i < JUMP_TABLE_MAX; i++) {
+        const uint16_t lo_addr = tables[0] + i * stride;
+        if (stride == 1 && lo_addr == tables[1]) {
+            break; // Ran into the high bytes
+        }
+        Location lo, hi;
+        if (!resolve(w, at, lo_addr, &lo) ||
+            !resolve(w, at, tables[1] + i * stride, &hi) ||
+            ((ca->flags[lo.loc] | ca->flags[hi.loc]) & CF_CODE)) {
+            break;
+        }
+        const uint16_t target = w->prg[lo.loc] | w->prg[hi.loc] << 8;
+        if (target < 0x8000) {
+            break;
+        }
+        add_pending(w, at, target);
+    }
+}
+
+// Marks instructions from at until control flow changes, queuing any
+// other location it can go to
+static void walk(Walker *w, Location at) {
+    CodeAnalysis *ca = w->ca;
+    Location history[HISTORY_LEN];
+    int history_len = 0;
+    CPU65xxDecoded d;
+    while (!(ca->flags[at.loc] & CF_CODE) && decode(w, at.loc, &d)) {
+        ca->flags[at.loc] |= CF_CODE;
+        ca->code_len++;
+        const uint16_t next_addr = at.addr + d.size;
+        if (is_branch(d.inst)) {
+            add_pending(w, &at, next_addr + (int8_t)d.operand);
+            add_pending(w, &at, next_addr);
+            return;
+        }
+        switch (d.inst) {
+            case 0x20: // JSR
+                add_pending(w, &at, d.operand);
+                add_pending(w, &at, next_addr);
+                return;
+            case 0x4C: // JMP
+                add_pending(w, &at, d.operand);
+                return;
+            case 0x6C: // JMP ()
+                follow_jump_table(w, &at, d.operand, history, history_len);
+                return;
+            case 0x00: // BRK
+            case 0x40: // RTI
+            case 0x60: // RTS
+                return;
+        }
+        if (history_len == HISTORY_LEN) {
+            memmove(history, history + 1, sizeof(Location) * --history_len);
+        }
+        history[history_len++] = at;
+        Location next;
+        if (!resolve(w, &at, next_addr, &next)) {
+            return;
+        }
+        at = next;
+    }
+}
+
+static void analyze(CodeAnalysis *ca, Machine *vm) {
+    Walker w = {
+        .vm = vm,
+        .ca = ca,
+        .prg = vm->cart.prg_rom.data,
+        .pending_cap = 256,
+    };
+    w.pending = malloc(sizeof(Location) * w.pending_cap);
+
+    const uint16_t vectors[] = {IVT_RESET, IVT_NMI, IVT_IRQ};
+    for (int i = 0; i < 3; i++) {
+        Location lo, hi;
+        if (!resolve(&w, NULL, vectors[i], &lo) ||
+            !resolve(&w, NULL, vectors[i] + 1, &hi)) {
+            continue;
+        }
+        add_pending(&w, NULL, w.prg[lo.loc] | w.prg[hi.loc] << 8);
+    }
+    while (w.pending_len) {
+        walk(&w, w.pending[--w.pending_len]);
+    }
+
+    free(w.pending);
+}
+
+// PREDECODING //
+
+// Fills the predecode cache with every instruction found, then the fused
+// sequences they start, so that blocks don't have to discover them one
+// instruction at a time as they first run
+static void warm_predecode(const CodeAnalysis *ca, Machine *vm) {
+    Cartridge *cart = &vm->cart;
+    if (!cart->prg_decoded) {
+        return;
+    }
+    for (uint32_t loc = 0; loc < ca->flags_len; loc++) {
+        if (ca->flags[loc] & CF_CODE) {
+            cpu_65xx_decode(&cart->prg_decoded[loc], cart->prg_rom.data + loc,
+                            SIZE_PRG_BANK - (loc & MASK_PRG_BANK));
+        }
+    }
+    for (size_t loc = 0; loc < ca->flags_len; loc += SIZE_PRG_BANK) {
+        cpu_65xx_detect_fusions(&cart->prg_decoded[loc]);
+    }
+}
+
+// CACHE //
+
+static int make_dir(const char *path) {
+#ifdef _WIN32
+    return mkdir(path);
+#else
+    return mkdir(path, 0755);
+#endif
+}
+
+static bool get_cache_path(char *path, size_t size, uint32_t prg_crc) {
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    int len;
+    if (xdg && *xdg) {
+        len = snprintf(path, size, "%s", xdg);
+    } else if (home && *home) {
+        len = snprintf(path, size, "%s/.cache", home);
+    } else {
+        return false;
+    }
+    make_dir(path);
+    len += snprintf(path + len, size - len, "/%s", APP_NAME);
+    make_dir(path);
+    snprintf(path + len, size - len, "/%08X.cfg", prg_crc);
+    return true;
+}
+
+static bool load_cache(CodeAnalysis *ca, const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return false;
+    }
+    AnalysisHeader header;
+    bool ok = (fread(&header, sizeof(AnalysisHeader), 1, f) == 1 &&
+               !memcmp(header.magic, ANALYSIS_MAGIC, sizeof(header.magic)) &&
+               header.version == ANALYSIS_VERSION &&
+               header.prg_crc == ca->prg_crc &&
+               header.prg_size == ca->flags_len &&
+               fread(ca->flags, 1, ca->flags_len, f) == ca->flags_len);
+    fclose(f);
+    if (!ok) {
+        memset(ca->flags, 0, ca->flags_len);
+        return false;
+    }
+    for (size_t i = 0; i < ca->flags_len; i++) {
+        ca->code_len += !!(ca->flags[i] & CF_CODE);
+    }
+    return true;
+}
+
+static bool save_cache(const CodeAnalysis *ca, const char *path) {
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        return false;
+    }
+    AnalysisHeader header = {
+        .version = ANALYSIS_VERSION,
+        .prg_crc = ca->prg_crc,
+        .prg_size = (uint32_t)ca->flags_len,
+    };
+    memcpy(header.magic, ANALYSIS_MAGIC, sizeof(header.magic));
+    bool ok = (fwrite(&header, sizeof(AnalysisHeader), 1, f) == 1 &&
+               fwrite(ca->flags, 1, ca->flags_len, f) == ca->flags_len);
+    return !fclose(f) && ok;
+}
+
+// PUBLIC FUNCTIONS //
+
+void analysis_init(CodeAnalysis *ca, Machine *vm, uint32_t prg_crc) {
+    memset(ca, 0, sizeof(CodeAnalysis));
+    ca->prg_crc = prg_crc;
+    ca->flags_len = vm->cart.prg_rom.size;
+    ca->flags = calloc(ca->flags_len, 1);
+
+    char path[1024];
+    const bool has_cache = get_cache_path(path, sizeof(path), prg_crc);
+    if (has_cache && load_cache(ca, path)) {
+        eprintf("Code analysis: %d instructions (cached)\n", ca->code_len);
+    } else {
+        analyze(ca, vm);
+        eprintf("Code analysis: %d instructions\n", ca->code_len);
+        if (has_cache && !save_cache(ca, path)) {
+            eprintf("%s: Error writing file\n", path);
+        }
+    }
+    // Logging code needs the fetches, which cached instructions skip
+    if (!vm->cdl) {
+        warm_predecode(ca, vm);
+    }
+}
+
+void analysis_teardown(CodeAnalysis *ca) {
+    free(ca->flags);
+}
@@ -0,0 +1,36 @@
+#ifndef f_analysis_h
+#define f_analysis_h
+
+#include "../common.h"
+
+#include "machine.h"
+
+#define ANALYSIS_MAGIC "FCFG"
+#define ANALYSIS_VERSION 2
+
+// Flags for every byte of PRG ROM
+typedef enum {
+    CF_CODE = 1 << 0, // First byte of a reachable instruction
+} CodeFlag;
+
+typedef struct CodeAnalysis {
+    uint32_t prg_crc;
+    uint8_t *flags;
+    size_t flags_len;
+    int code_len; // Instructions found
+} CodeAnalysis;
+
+typedef struct AnalysisHeader {
+    char magic[4];
+    uint16_t version;
+    uint16_t padding;
+    uint32_t prg_crc;
+    uint32_t prg_size;
+} AnalysisHeader;
+
+// Finds the code reachable from the vectors and predecodes all of it,
+// fused sequences included (unless the CDL needs every fetch to happen)
+void analysis_init(CodeAnalysis *ca, Machine *vm, uint32_t prg_crc);
+void analysis_teardown(CodeAnalysis *ca);
+
+#endif /* f_analysis_h */
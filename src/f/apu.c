@@ -272,32 +272,32 @@ void apu_init(APU *apu, CPU65xx *cpu, int16_t *audio_buffer, int *audio_pos) {
     MemoryMap *mm = cpu->mm;
     
     // 4000-4007: Pulse channels
-    for (int i = 0; i < 8; i += 4) {
-        mm->write[0x4000 + i] = write_envelope_volume;
-        mm->write[0x4001 + i] = write_pulse_sweep;
-        mm->write[0x4002 + i] = write_timer_low;
-        mm->write[0x4003 + i] = write_length_counter_timer_high;
+    for (int i = 0x4000; i < 0x4008; i += 4) {
+        mm_map_write(mm, i, i, write_envelope_volume);
+        mm_map_write(mm, i + 1, i + 1, write_pulse_sweep);
+        mm_map_write(mm, i + 2, i + 2, write_timer_low);
+        mm_map_write(mm, i + 3, i + 3, write_length_counter_timer_high);
     }
     // 4008-400B: Triangle channel
-    mm->write[0x4008] = write_triangle_linear_counter;
+    mm_map_write(mm, 0x4008, 0x4008, write_triangle_linear_counter);
     //        0x4009 Unused
-    mm->write[0x400A] = write_timer_low;
-    mm->write[0x400B] = write_length_counter_timer_high;
+    mm_map_write(mm, 0x400A, 0x400A, write_timer_low);
+    mm_map_write(mm, 0x400B, 0x400B, write_length_counter_timer_high);
     // 400C-400F: Noise channel
-    mm->write[0x400C] = write_envelope_volume;
+    mm_map_write(mm, 0x400C, 0x400C, write_envelope_volume);
     //        0x400D Unused
-    mm->write[0x400E] = write_noise_mode_period;
-    mm->write[0x400F] = write_length_counter_timer_high;
+    mm_map_write(mm, 0x400E, 0x400E, write_noise_mode_period);
+    mm_map_write(mm, 0x400F, 0x400F, write_length_counter_timer_high);
     // 4010-4013: DMC channel
-    mm->write[0x4010] = write_dmc_flags_rate;
-    mm->write[0x4011] = write_dmc_load;
-    mm->write[0x4012] = write_dmc_addr;
-    mm->write[0x4013] = write_dmc_length;
+    mm_map_write(mm, 0x4010, 0x4010, write_dmc_flags_rate);
+    mm_map_write(mm, 0x4011, 0x4011, write_dmc_load);
+    mm_map_write(mm, 0x4012, 0x4012, write_dmc_addr);
+    mm_map_write(mm, 0x4013, 0x4013, write_dmc_length);
     // 4015: Status and control
-    mm->read[0x4015] = read_status;
-    mm->write[0x4015] = write_control;
+    mm_map_read(mm, 0x4015, 0x4015, read_status);
+    mm_map_write(mm, 0x4015, 0x4015, write_control);
     // 4017: Frame control (write only, overlaps controller #2 on read)
-    mm->write[0x4017] = write_frame_counter;
+    mm_map_write(mm, 0x4017, 0x4017, write_frame_counter);
 }
 
 void apu_step(APU *apu) {
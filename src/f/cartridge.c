@@ -1,24 +1,16 @@
 #include "cartridge.h"
 
 #include "../cpu/65xx.h"
+#include "cheats.h"
 #include "machine.h"
 #include "memory_maps.h"
 
 // GENERIC MAPPER I/O //
 
-static uint8_t read_prg(Machine *vm, uint16_t addr) {
-    return vm->cart.prg_banks[(addr >> 13) & (PRG_BANKS - 1)]
-                             [addr & MASK_PRG_BANK];
-}
-
 static uint8_t read_chr(Machine *vm, uint16_t addr) {
     return vm->cart.chr_banks[(addr >> 10) & (CHR_BANKS - 1)]
                              [addr & MASK_CHR_BANK];
 }
-static void write_chr(Machine *vm, uint16_t addr, uint8_t value) {
-    vm->cart.chr_banks[(addr >> 10) & (CHR_BANKS - 1)]
-                      [addr & MASK_CHR_BANK] = value;
-}
 
 static uint8_t read_sram(Machine *vm, uint16_t addr) {
     if (vm->cart.sram_enabled) {
@@ -39,26 +31,38 @@ static void init_sram(Machine *vm, int size) {
     vm->cart.sram.data = malloc(size);
     
     // 6000-7FFF: SRAM (up to 8kB, repeated if less)
-    for (int i = 0; i < SIZE_SRAM; i++) {
-        vm->cpu_mm.read[0x6000 + i] = read_sram;
-        vm->cpu_mm.write[0x6000 + i] = write_sram;
-    }
+    mm_map_read(&vm->cpu_mm, 0x6000, 0x7FFF, read_sram);
+    mm_map_write(&vm->cpu_mm, 0x6000, 0x7FFF, write_sram);
 }
 
 static void init_register_prg(Machine *vm, WriteFuncPtr register_func) {
-    for (int i = 0; i < SIZE_PRG_ROM; i++) {
-        vm->cpu_mm.write[0x8000 + i] = register_func;
-    }
+    mm_map_write(&vm->cpu_mm, 0x8000, 0xFFFF, register_func);
 }
 
 static void init_register_sram(Machine *vm, WriteFuncPtr register_func) {
-    for (int i = 0; i < SIZE_SRAM; i++) {
-        vm->cpu_mm.write[0x6000 + i] = register_func;
-    }
+    mm_map_write(&vm->cpu_mm, 0x6000, 0x7FFF, register_func);
 }
 
 // BANK SELECT //
 
+// Points the memory pages (and predecoded code) at the banks selected
+static void update_prg_banks(Cartridge *cart) {
+    mm_set_banks(cart->prg_pages, cart->prg_banks, PRG_BANKS, SIZE_PRG_BANK);
+    if (cart->decoded_banks) {
+        for (int i = 0; i < PRG_BANKS; i++) {
+            cart->decoded_banks[i] = cart->prg_decoded +
+                                     (cart->prg_banks[i] - cart->prg_rom.data);
+        }
+    }
+    if (cart->cheats) {
+        cheats_apply(cart->cheats);
+    }
+}
+
+static void update_chr_banks(Cartridge *cart) {
+    mm_set_banks(cart->chr_pages, cart->chr_banks, CHR_BANKS, SIZE_CHR_BANK);
+}
+
 static void select_prg_full(Cartridge *cart, uint8_t pos) {
     uint8_t *offset = cart->prg_rom.data + ((pos << 15) % cart->prg_rom.size);
     cart->prg_banks[0] = offset;
@@ -69,6 +73,7 @@ static void select_prg_full(Cartridge *cart, uint8_t pos) {
         cart->prg_banks[i] = offset;
         offset += SIZE_PRG_BANK;
     }
+    update_prg_banks(cart);
 }
 
 static void select_prg_half(Cartridge *cart, int bank, uint8_t pos) {
@@ -76,11 +81,13 @@ static void select_prg_half(Cartridge *cart, int bank, uint8_t pos) {
     bank <<= 1;
     cart->prg_banks[bank] = offset;
     cart->prg_banks[bank + 1] = offset + SIZE_PRG_BANK;
+    update_prg_banks(cart);
 }
 
 static void select_prg_quarter(Cartridge *cart, int bank, uint8_t pos) {
     cart->prg_banks[bank] = cart->prg_rom.data +
                             ((pos << 13) % cart->prg_rom.size);
+    update_prg_banks(cart);
 }
 
 static void select_chr_full(Cartridge *cart, uint8_t pos) {
@@ -94,6 +101,7 @@ static void select_chr_full(Cartridge *cart, uint8_t pos) {
     cart->chr_banks[5] = offset + SIZE_CHR_BANK * 5;
     cart->chr_banks[6] = offset + SIZE_CHR_BANK * 6;
     cart->chr_banks[7] = offset + SIZE_CHR_BANK * 7;
+    update_chr_banks(cart);
 }
 
 static void select_chr_half(Cartridge *cart, int bank, uint8_t pos) {
@@ -104,6 +112,7 @@ static void select_chr_half(Cartridge *cart, int bank, uint8_t pos) {
     cart->chr_banks[bank + 1] = offset + SIZE_CHR_BANK;
     cart->chr_banks[bank + 2] = offset + SIZE_CHR_BANK * 2;
     cart->chr_banks[bank + 3] = offset + SIZE_CHR_BANK * 3;
+    update_chr_banks(cart);
 }
 
 static void select_chr_quarter(Cartridge *cart, int bank, uint8_t pos) {
@@ -112,11 +121,13 @@ static void select_chr_quarter(Cartridge *cart, int bank, uint8_t pos) {
     bank <<= 1;
     cart->chr_banks[bank] = offset;
     cart->chr_banks[bank + 1] = offset + SIZE_CHR_BANK;
+    update_chr_banks(cart);
 }
 
 static void select_chr_eighth(Cartridge *cart, int bank, uint8_t pos) {
     cart->chr_banks[bank] = cart->chr_memory.data +
                             ((pos << 10) % cart->chr_memory.size);
+    update_chr_banks(cart);
 }
 
 static int get_prg_last_half(Cartridge *cart, uint8_t pos) {
@@ -335,6 +346,23 @@ static void MMC3_write_register_irq_enable(Machine *vm, uint16_t addr,
     vm->cart.mapper.mmc3.irq_enabled = true;
 }
 
+// Registers come in pairs every 8kB, told apart by A0
+static void MMC3_write_register(Machine *vm, uint16_t addr, uint8_t value) {
+    static const WriteFuncPtr registers[] = {
+        MMC3_write_register_bank_select, MMC3_write_register_bank_data,
+        // SRAM protect, intentionally not implemented to ensure
+        // cross-compatibility with MMC6 which shares the same mapper ID
+        MMC3_write_register_mirroring, NULL,
+        MMC3_write_register_irq_latch, MMC3_write_register_irq_reload,
+        MMC3_write_register_irq_disable, MMC3_write_register_irq_enable,
+    };
+    const WriteFuncPtr register_func = registers[((addr >> 12) & 6) |
+                                                 (addr & 1)];
+    if (register_func) {
+        (*register_func)(vm, addr, value);
+    }
+}
+
 static uint8_t MMC3_read_chr(Machine *vm, uint16_t addr) {
     MMC3State *mmc = &vm->cart.mapper.mmc3;
     bool current_pt = addr & (1 << 12);
@@ -359,28 +387,9 @@ static void MMC3_init(Machine *vm) {
     select_prg_quarter(cart, 3, get_prg_last_quarter(cart, 1));
     MMC3_update_banks(cart);
     
-    int i = 0x8000;
-    while (i < 0xA000) {
-        vm->cpu_mm.write[i++] = MMC3_write_register_bank_select;
-        vm->cpu_mm.write[i++] = MMC3_write_register_bank_data;
-    }
-    while (i < 0xC000) {
-        vm->cpu_mm.write[i++] = MMC3_write_register_mirroring;
-        i++;    // SRAM protect, intentionally not implemented to ensure
-                // cross-compatibility with MMC6 which shares the same mapper ID
-    }
-    while (i < 0xE000) {
-        vm->cpu_mm.write[i++] = MMC3_write_register_irq_latch;
-        vm->cpu_mm.write[i++] = MMC3_write_register_irq_reload;
-    }
-    while (i < 0x10000) {
-        vm->cpu_mm.write[i++] = MMC3_write_register_irq_disable;
-        vm->cpu_mm.write[i++] = MMC3_write_register_irq_enable;
-    }
-    
-    for (int i = 0; i < SIZE_CHR_ROM; i++) {
-        vm->ppu_mm.read[i] = MMC3_read_chr;
-    }
+    init_register_prg(vm, MMC3_write_register);
+    mm_map_read(&vm->ppu_mm, 0x0000, 0x1FFF, MMC3_read_chr);
+    cart->mapper_irq_enabled = &cart->mapper.mmc3.irq_enabled;
     
     init_sram(vm, SIZE_SRAM);
 }
@@ -475,20 +484,12 @@ static uint8_t MMC24_read_chr(Machine *vm, uint16_t addr) {
 static void MMC24_init_common(Machine *vm, WriteFuncPtr register_prg_func) {
     memset(&vm->cart.mapper.mmc24, 0, sizeof(MMC24State));
     
-    int i = 0xA000;
-    while (i < 0xB000) {
-        vm->cpu_mm.write[i++] = register_prg_func;
-    }
-    while (i < 0xF000) {
-        vm->cpu_mm.write[i++] = MMC24_write_register_chr;
-    }
-    while (i < 0x10000) {
-        vm->cpu_mm.write[i++] = MMC24_write_register_mirroring;
-    }
+    MemoryMap *cpu_mm = &vm->cpu_mm;
+    mm_map_write(cpu_mm, 0xA000, 0xAFFF, register_prg_func);
+    mm_map_write(cpu_mm, 0xB000, 0xEFFF, MMC24_write_register_chr);
+    mm_map_write(cpu_mm, 0xF000, 0xFFFF, MMC24_write_register_mirroring);
     
-    for (int i = 0; i < SIZE_CHR_ROM; i++) {
-        vm->ppu_mm.read[i] = MMC24_read_chr;
-    }
+    mm_map_read(&vm->ppu_mm, 0x0000, 0x1FFF, MMC24_read_chr);
 }
 
 static void MMC2_init(Machine *vm) {
@@ -567,9 +568,7 @@ static void PCI556_write_register(Machine *vm, uint16_t addr, uint8_t value) {
 
 static void PCI556_init(Machine *vm) {
     // Register is only in the upper half of the SRAM area
-    for (int i = 0x7000; i < 0x8000; i++) {
-        vm->cpu_mm.write[i] = PCI556_write_register;
-    }
+    mm_map_write(&vm->cpu_mm, 0x7000, 0x7FFF, PCI556_write_register);
 }
 
 // MAPPER  66: Nintendo GNROM and MHROM (32b/8b)                          //
@@ -605,6 +604,7 @@ static void Sunsoft4_update_nametables(Machine *vm) {
     for (int i = 0; i < 4; i++) {
         vm->nt_layout[i] = memory[layout[i]];
     }
+    machine_map_nametables(vm);
 }
 
 static void Sunsoft4_write_register_chr(Machine *vm, uint16_t addr,
@@ -644,27 +644,18 @@ static void Sunsoft4_init(Machine *vm) {
     Cartridge *cart = &vm->cart;
     memset(&cart->mapper.sunsoft4, 0, sizeof(Sunsoft4State));
     
-    for (int i = 0x8000; i < 0xC000; i++) {
-        vm->cpu_mm.write[i] = Sunsoft4_write_register_chr;
-    }
-    for (int i = 0xC000; i < 0xE000; i++) {
-        vm->cpu_mm.write[i] = Sunsoft4_write_register_nt;
-    }
-    for (int i = 0xE000; i < 0xF000; i++) {
-        vm->cpu_mm.write[i] = Sunsoft4_write_register_ctrl;
-    }
-    for (int i = 0xF000; i < 0x10000; i++) {
-        vm->cpu_mm.write[i] = Sunsoft4_write_register_prg;
-    }
+    MemoryMap *cpu_mm = &vm->cpu_mm;
+    mm_map_write(cpu_mm, 0x8000, 0xBFFF, Sunsoft4_write_register_chr);
+    mm_map_write(cpu_mm, 0xC000, 0xDFFF, Sunsoft4_write_register_nt);
+    mm_map_write(cpu_mm, 0xE000, 0xEFFF, Sunsoft4_write_register_ctrl);
+    mm_map_write(cpu_mm, 0xF000, 0xFFFF, Sunsoft4_write_register_prg);
     
     init_sram(vm, SIZE_SRAM);
     
     select_prg_half(cart, 1, get_prg_last_half(cart, 1));
     
     // Need to enforce write protection when CHR ROM is mapped to NT
-    for (int i = 0; i < 0x1EFF; i++) {
-        vm->ppu_mm.write[0x2000 + i] = Sunsoft4_write_nametables;
-    }
+    mm_map_write(&vm->ppu_mm, 0x2000, 0x3EFE, Sunsoft4_write_nametables);
 }
 
 // MAPPER  70: Bandai 74*161/161/32 (16b+16f/8b with equivalent register) //
@@ -728,17 +719,12 @@ static void VRC1_init(Machine *vm) {
     select_prg_quarter(cart, 3, get_prg_last_quarter(cart, 1));
     cart->mapper.vrc1_chr_banks[0] = cart->mapper.vrc1_chr_banks[1] = 0;
     
+    MemoryMap *cpu_mm = &vm->cpu_mm;
     for (int i = 0x8000; i < 0xE000; i += 0x2000) {
-        for (int j = 0; j < 0x1000; j++) {
-            vm->cpu_mm.write[i + j] = VRC1_write_register_prg;
-        }
-    }
-    for (int i = 0x9000; i < 0xA000; i++) {
-        vm->cpu_mm.write[i] = VRC1_write_register_misc;
-    }
-    for (int i = 0xE000; i < 0x10000; i++) {
-        vm->cpu_mm.write[i] = VRC1_write_register_chr;
+        mm_map_write(cpu_mm, i, i + 0xFFF, VRC1_write_register_prg);
     }
+    mm_map_write(cpu_mm, 0x9000, 0x9FFF, VRC1_write_register_misc);
+    mm_map_write(cpu_mm, 0xE000, 0xFFFF, VRC1_write_register_chr);
 }
 
 // MAPPER  79: American Video Entertainment NINA-03/06 (32b/8b)      //
@@ -760,9 +746,7 @@ static void NINA0306MC_write_register(Machine *vm, uint16_t addr,
 
 static void NINA0306_init_register(Machine *vm, WriteFuncPtr register_func) {
     // The register is at a more complicated location but who cares
-    for (int i = 0x4100; i < 0x6000; i++) {
-        vm->cpu_mm.write[i] = register_func;
-    }
+    mm_map_write(&vm->cpu_mm, 0x4100, 0x5FFF, register_func);
 }
 
 static void NINA0306_init(Machine *vm) {
@@ -829,8 +813,8 @@ static void VS_write_register(Machine *vm, uint16_t addr, uint8_t value) {
 static void VS_init(Machine *vm) {
     Cartridge *cart = &vm->cart;
     
-    cart->mapper.hijacked_reg = vm->cpu_mm.write[0x4016];
-    vm->cpu_mm.write[0x4016] = VS_write_register;
+    cart->mapper.hijacked_reg = mm_get_write(&vm->cpu_mm, 0x4016);
+    mm_map_write(&vm->cpu_mm, 0x4016, 0x4016, VS_write_register);
     
     init_sram(vm, SIZE_SRAM);
 }
@@ -861,9 +845,7 @@ static uint8_t CNROM_CP_read_chr(Machine *vm, uint16_t addr) {
 static void CNROM_CP_init(Machine *vm) {
     vm->cart.mapper.cp_counter = 0;
     
-    for (int i = 0; i < SIZE_CHR_ROM; i++) {
-        vm->ppu_mm.read[i] = CNROM_CP_read_chr;
-    }
+    mm_map_read(&vm->ppu_mm, 0x0000, 0x1FFF, CNROM_CP_read_chr);
 }
 
 // MAPPER ENUMERATION ARRAY //
@@ -1063,13 +1045,19 @@ void mapper_init(Machine *vm, int mapper_id) {
     }
     
     // CPU 8000-FFFF: PRG ROM (32kB, repeated if 16kB)
-    for (int i = 0; i < SIZE_PRG_ROM; i++) {
-        vm->cpu_mm.read[0x8000 + i] = read_prg;
+    cart->prg_pages = &vm->cpu_mm.pages[0x8000 >> MM_PAGE_SHIFT];
+    for (int i = 0; i < PRG_BANKS; i++) {
+        const uint16_t addr = 0x8000 + SIZE_PRG_BANK * i;
+        mm_map_memory(&vm->cpu_mm, addr, addr + MASK_PRG_BANK,
+                      cart->prg_banks[i], SIZE_PRG_BANK, false);
     }
     
-    // PPU 0000-1FFF: CHR ROM (8kB)
-    for (int i = 0; i < SIZE_CHR_ROM; i++) {
-        vm->ppu_mm.read[i] = read_chr;
+    // PPU 0000-1FFF: CHR ROM (8kB), or RAM
+    cart->chr_pages = &vm->ppu_mm.pages[0];
+    for (int i = 0; i < CHR_BANKS; i++) {
+        const uint16_t addr = SIZE_CHR_BANK * i;
+        mm_map_memory(&vm->ppu_mm, addr, addr + MASK_CHR_BANK,
+                      cart->chr_banks[i], SIZE_CHR_BANK, cart->chr_is_ram);
     }
     
     for (int i = 0; i < mappers_len; i++) {
@@ -1079,9 +1067,21 @@ void mapper_init(Machine *vm, int mapper_id) {
         }
     }
     
-    if (cart->chr_is_ram) {
-        for (int i = 0; i < SIZE_CHR_ROM; i++) {
-            vm->ppu_mm.write[i] = write_chr;
+    // Predecode the CPU code from PRG ROM, unless the mapper put anything
+    // other than plain ROM reads in that range
+    for (int i = 0; i < (SIZE_PRG_ROM >> MM_PAGE_SHIFT); i++) {
+        if (!cart->prg_pages[i].direct_read) {
+            return;
         }
     }
+    cart->prg_decoded = calloc(cart->prg_rom.size, sizeof(CPU65xxDecoded));
+    cart->decoded_banks = &vm->cpu.decoded[0x8000 >> DECODED_PAGE_SHIFT];
+    vm->cpu.open_bus = &vm->cpu_mm.last_read;
+    update_prg_banks(cart);
+    // No side effects either, so CPU blocks can read from it
+    memset(vm->cpu.block_access + 0x80, BA_READ, 0x80);
+}
+
+void mapper_update_prg_banks(Cartridge *cart) {
+    update_prg_banks(cart);
 }
@@ -2,6 +2,7 @@
 #define f_cartridge_h
 
 #include "../common.h"
+#include "../cpu/65xx.h"
 
 #define SIZE_SRAM 0x2000
 #define MASK_SRAM (SIZE_SRAM - 1)
@@ -15,7 +16,9 @@
 #define MASK_CHR_BANK (SIZE_CHR_BANK - 1)
 
 // Forward declarations
+typedef struct CheatList CheatList;
 typedef struct Machine Machine;
+typedef struct MemoryPage MemoryPage;
 
 typedef struct MMC1State {
     int shift_pos;
@@ -66,11 +69,18 @@ typedef struct Cartridge {
     // PRG ROM
     blob prg_rom;
     uint8_t *prg_banks[4];
+    CPU65xxDecoded *prg_decoded;
+    CPU65xxDecoded **decoded_banks;
+    MemoryPage *prg_pages; // CPU memory pages over PRG ROM
+    CheatList *cheats; // NULL unless any
+    uint8_t *prg_cdl; // Code/data log flags, NULL unless enabled
     
     // CHR ROM/RAM
     blob chr_memory;
     bool chr_is_ram;
     uint8_t *chr_banks[8];
+    MemoryPage *chr_pages; // PPU memory pages over CHR ROM/RAM
+    uint8_t *chr_cdl; // Same for CHR ROM only
     
     // SRAM (aka. PRG RAM)
     blob sram;
@@ -79,6 +89,7 @@ typedef struct Cartridge {
     
     // Memory mapper
     Mapper mapper;
+    const bool *mapper_irq_enabled; // NULL if the mapper has no IRQ
 } Cartridge;
 
 typedef struct MapperInfo {
@@ -90,5 +101,7 @@ typedef struct MapperInfo {
 bool mapper_check_support(int mapper_id, const char **name);
 
 void mapper_init(Machine *vm, int mapper_id);
+// Points everything depending on the PRG banks selected at them again
+void mapper_update_prg_banks(Cartridge *cart);
 
 #endif /* f_cartridge_h */
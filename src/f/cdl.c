@@ -0,0 +1,175 @@
+#include "cdl.h"
+
+// WRAPPED HANDLERS //
+
+static void wrap_pages(MemoryMap *mm, uint16_t first, WrappedPage *pages,
+                       int pages_len, ReadFuncPtr func) {
+    for (int i = 0; i < pages_len; i++) {
+        const MemoryPage *page = &mm->pages[(first >> MM_PAGE_SHIFT) + i];
+        pages[i].read = page->read;
+        pages[i].reads = NULL;
+        if (page->reads) {
+            pages[i].reads = malloc(sizeof(ReadFuncPtr) * MM_PAGE_SIZE);
+            memcpy(pages[i].reads, page->reads,
+                   sizeof(ReadFuncPtr) * MM_PAGE_SIZE);
+        }
+    }
+    mm_map_read(mm, first, first + (pages_len << MM_PAGE_SHIFT) - 1, func);
+}
+
+static void unwrap_pages(MemoryMap *mm, uint16_t first, WrappedPage *pages,
+                         int pages_len) {
+    for (int i = 0; i < pages_len; i++) {
+        const uint16_t addr = first + (i << MM_PAGE_SHIFT);
+        if (pages[i].reads) {
+            mm_map_reads(mm, addr, addr | MASK_MM_PAGE, pages[i].reads);
+            free(pages[i].reads);
+            pages[i].reads = NULL;
+        } else {
+            mm_map_read(mm, addr, addr | MASK_MM_PAGE, pages[i].read);
+        }
+    }
+}
+
+static inline ReadFuncPtr get_wrapped(const WrappedPage *pages,
+                                      uint16_t offset) {
+    const WrappedPage *page = &pages[offset >> MM_PAGE_SHIFT];
+    return (page->reads ? page->reads[offset & MASK_MM_PAGE] : page->read);
+}
+
+// LOGGING HANDLERS //
+
+static uint8_t log_read_prg(Machine *vm, uint16_t addr) {
+    CodeDataLogger *cdl = vm->cdl;
+    Cartridge *cart = &vm->cart;
+    const ReadFuncPtr read = get_wrapped(cdl->prg_pages, addr & MASK_PRG_ROM);
+    const uint8_t value = (*read)(vm, addr);
+
+    uint8_t flags = ((addr >> 13) & 3) << CDL_WINDOW_SHIFT;
+    // Fetches happen with PC right past the byte being read, and the dummy
+    // read of implied instructions right on it
+    const uint16_t pc = vm->cpu.pc;
+    if (addr == (uint16_t)(pc - 1)) {
+        flags |= CDL_CODE;
+        if (cdl->operands_left && addr == cdl->next_operand) {
+            cdl->operands_left--;
+        } else {
+            flags |= CDL_OPCODE;
+            CPU65xxDecoded decoded;
+            const uint8_t code[3] = {value};
+            cdl->operands_left = cpu_65xx_decode(&decoded, code, 3) - 1;
+        }
+        cdl->next_operand = addr + 1;
+    } else if (addr != pc) {
+        flags |= CDL_DATA;
+    }
+
+    const uint8_t *rom = cart->prg_banks[(addr >> 13) & (PRG_BANKS - 1)] +
+                         (addr & MASK_PRG_BANK);
+    uint8_t *logged = cart->prg_cdl + (rom - cart->prg_rom.data);
+    *logged = (*logged & ~(3 << CDL_WINDOW_SHIFT)) | flags;
+    return value;
+}
+
+static uint8_t log_read_chr(Machine *vm, uint16_t addr) {
+    CodeDataLogger *cdl = vm->cdl;
+    Cartridge *cart = &vm->cart;
+    const uint8_t value = (*get_wrapped(cdl->chr_pages, addr))(vm, addr);
+    const uint8_t *rom = cart->chr_banks[(addr >> 10) & (CHR_BANKS - 1)] +
+                         (addr & MASK_CHR_BANK);
+    cart->chr_cdl[rom - cart->chr_memory.data] |= cdl->chr_flags;
+    return value;
+}
+
+static uint8_t log_read_ppudata(Machine *vm, uint16_t addr) {
+    CodeDataLogger *cdl = vm->cdl;
+    // Catching up on a deferred scanline is rendering, not the CPU reading
+    if (vm->ppu.is_deferred) {
+        machine_sync_ppu(vm);
+    }
+    cdl->chr_flags = CDL_READ;
+    const uint8_t value = (*cdl->ppudata_read)(vm, addr);
+    cdl->chr_flags = CDL_RENDERED;
+    return value;
+}
+
+// PUBLIC FUNCTIONS //
+
+void cdl_init(CodeDataLogger *cdl, Machine *vm, const char *path) {
+    memset(cdl, 0, sizeof(CodeDataLogger));
+    cdl->vm = vm;
+    cdl->path = path;
+    cdl->chr_flags = CDL_RENDERED;
+
+    Cartridge *cart = &vm->cart;
+    cart->prg_cdl = calloc(cart->prg_rom.size, 1);
+    // CHR RAM gets rewritten all the time, there is nothing to learn there
+    if (!cart->chr_is_ram) {
+        cart->chr_cdl = calloc(cart->chr_memory.size, 1);
+    }
+    FILE *f = fopen(path, "rb");
+    if (f) {
+        if (fread(cart->prg_cdl, cart->prg_rom.size, 1, f) < 1 ||
+            (cart->chr_cdl &&
+             fread(cart->chr_cdl, cart->chr_memory.size, 1, f) < 1)) {
+            eprintf("%s: Not a matching CDL file, starting over\n", path);
+            memset(cart->prg_cdl, 0, cart->prg_rom.size);
+            if (cart->chr_cdl) {
+                memset(cart->chr_cdl, 0, cart->chr_memory.size);
+            }
+        }
+        fclose(f);
+    }
+
+    // Only the handlers change, so nothing else is any slower
+    MemoryMap *cpu_mm = &vm->cpu_mm;
+    wrap_pages(cpu_mm, 0x8000, cdl->prg_pages,
+               SIZE_PRG_ROM >> MM_PAGE_SHIFT, log_read_prg);
+    if (cart->chr_cdl) {
+        wrap_pages(&vm->ppu_mm, 0x0000, cdl->chr_pages,
+                   SIZE_CHR_ROM >> MM_PAGE_SHIFT, log_read_chr);
+        cdl->ppudata_read = mm_get_read(cpu_mm, 0x2000 | PPUDATA);
+        for (int i = 0x2000 | PPUDATA; i < 0x4000; i += 8) {
+            mm_map_read(cpu_mm, i, i, log_read_ppudata);
+        }
+    }
+
+    // Instructions already predecoded would never be fetched again, so drop
+    // them to get them logged the first time they run
+    if (cart->prg_decoded) {
+        memset(cart->prg_decoded, 0,
+               sizeof(CPU65xxDecoded) * cart->prg_rom.size);
+    }
+}
+
+void cdl_teardown(CodeDataLogger *cdl) {
+    Machine *vm = cdl->vm;
+    Cartridge *cart = &vm->cart;
+    unwrap_pages(&vm->cpu_mm, 0x8000, cdl->prg_pages,
+                 SIZE_PRG_ROM >> MM_PAGE_SHIFT);
+    if (cart->chr_cdl) {
+        unwrap_pages(&vm->ppu_mm, 0x0000, cdl->chr_pages,
+                     SIZE_CHR_ROM >> MM_PAGE_SHIFT);
+        for (int i = 0x2000 | PPUDATA; i < 0x4000; i += 8) {
+            mm_map_read(&vm->cpu_mm, i, i, cdl->ppudata_read);
+        }
+    }
+    free(cart->prg_cdl);
+    free(cart->chr_cdl);
+    cart->prg_cdl = NULL;
+    cart->chr_cdl = NULL;
+}
+
+// PRG ROM flags followed by CHR ROM flags, as FCEUX expects them
+bool cdl_save(CodeDataLogger *cdl) {
+    Cartridge *cart = &cdl->vm->cart;
+    FILE *f = fopen(cdl->path, "wb");
+    if (!f) {
+        return false;
+    }
+    fwrite(cart->prg_cdl, cart->prg_rom.size, 1, f);
+    if (cart->chr_cdl) {
+        fwrite(cart->chr_cdl, cart->chr_memory.size, 1, f);
+    }
+    return !fclose(f);
+}
@@ -0,0 +1,52 @@
+#ifndef f_cdl_h
+#define f_cdl_h
+
+#include "../common.h"
+
+#include "machine.h"
+
+// Flags for every byte of PRG ROM, laid out as in FCEUX's CDL files
+typedef enum {
+    CDL_CODE   = 1 << 0, // Fetched as part of an instruction
+    CDL_DATA   = 1 << 1, // Read by the CPU otherwise
+    CDL_OPCODE = 1 << 7, // First byte of an instruction (unused by FCEUX)
+} CDLPRGFlag;
+// Bits 2-3: Which 8kB of the CPU address space it was last mapped to
+#define CDL_WINDOW_SHIFT 2
+
+// Flags for every byte of CHR ROM
+typedef enum {
+    CDL_RENDERED = 1 << 0, // Fetched by the PPU to draw the picture
+    CDL_READ     = 1 << 1, // Read by the CPU through PPUDATA
+} CDLCHRFlag;
+
+// Read handlers of a page wrapped by the logging ones, with a copy of the
+// ones per address if it has any
+typedef struct WrappedPage {
+    ReadFuncPtr read;
+    ReadFuncPtr *reads;
+} WrappedPage;
+
+typedef struct CodeDataLogger {
+    Machine *vm;
+    const char *path;
+
+    // Handlers wrapped by the logging ones
+    WrappedPage prg_pages[SIZE_PRG_ROM >> MM_PAGE_SHIFT];
+    WrappedPage chr_pages[SIZE_CHR_ROM >> MM_PAGE_SHIFT];
+    ReadFuncPtr ppudata_read;
+
+    // Operand bytes still expected from the instruction being fetched
+    uint16_t next_operand;
+    int operands_left;
+    uint8_t chr_flags;
+} CodeDataLogger;
+
+// The flags themselves are kept in the cartridge, and accumulate with those
+// of any existing file at path
+void cdl_init(CodeDataLogger *cdl, Machine *vm, const char *path);
+void cdl_teardown(CodeDataLogger *cdl);
+
+bool cdl_save(CodeDataLogger *cdl);
+
+#endif /* f_cdl_h */
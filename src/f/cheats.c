@@ -0,0 +1,120 @@
+#include "cheats.h"
+#include <ctype.h>
+
+static const char genie_letters[] = "APZLGITYEOXUKSVN";
+
+// DECODING //
+
+static bool decode_genie(Cheat *cheat, const char *code, size_t len) {
+    uint8_t n[8];
+    for (size_t i = 0; i < len; i++) {
+        const char *letter = strchr(genie_letters,
+                                    toupper((unsigned char)code[i]));
+        if (!letter) {
+            return false;
+        }
+        n[i] = letter - genie_letters;
+    }
+    // The bits of every field are scattered among the letters
+    cheat->addr = 0x8000 | ((n[3] & 7) << 12) | ((n[5] & 7) << 8) |
+                  ((n[4] & 8) << 8) | ((n[2] & 7) << 4) | ((n[1] & 8) << 4) |
+                  (n[4] & 7) | (n[3] & 8);
+    cheat->value = ((n[1] & 7) << 4) | ((n[0] & 8) << 4) | (n[0] & 7);
+    cheat->has_compare = (len == 8);
+    if (cheat->has_compare) {
+        cheat->value |= n[7] & 8;
+        cheat->compare = ((n[7] & 7) << 4) | ((n[6] & 8) << 4) |
+                         (n[6] & 7) | (n[5] & 8);
+    } else {
+        cheat->value |= n[5] & 8;
+        cheat->compare = 0;
+    }
+    return true;
+}
+
+static bool decode_raw(Cheat *cheat, const char *code) {
+    unsigned int addr, value, compare;
+    char extra;
+    if (sscanf(code, "%4x?%2x:%2x%c", &addr, &compare, &value, &extra) == 3) {
+        cheat->has_compare = true;
+    } else if (sscanf(code, "%4x:%2x%c", &addr, &value, &extra) == 2) {
+        cheat->has_compare = false;
+        compare = 0;
+    } else {
+        return false;
+    }
+    cheat->addr = addr;
+    cheat->value = value;
+    cheat->compare = compare;
+    // Only PRG ROM can be patched
+    return addr >= 0x8000;
+}
+
+// OVERLAYS //
+
+static const uint8_t *get_rom(const Cartridge *cart, uint16_t addr) {
+    return cart->prg_banks[(addr >> 13) & (PRG_BANKS - 1)] +
+           (addr & MASK_PRG_BANK);
+}
+
+static MemoryPage *get_page(Cartridge *cart, uint16_t addr) {
+    return &cart->prg_pages[(addr & 0x7FFF) >> MM_PAGE_SHIFT];
+}
+
+// PUBLIC FUNCTIONS //
+
+bool cheat_decode(Cheat *cheat, const char *code) {
+    const size_t len = strlen(code);
+    if ((len == 6 || len == 8) && decode_genie(cheat, code, len)) {
+        return true;
+    }
+    return decode_raw(cheat, code);
+}
+
+void cheats_init(CheatList *list, Machine *vm) {
+    memset(list, 0, sizeof(CheatList));
+    list->cart = &vm->cart;
+    vm->cart.cheats = list;
+}
+
+void cheats_teardown(CheatList *list) {
+    list->cart->cheats = NULL;
+    mapper_update_prg_banks(list->cart);
+}
+
+bool cheats_add(CheatList *list, const Cheat *cheat) {
+    if (list->cheats_len == CHEATS_MAX) {
+        return false;
+    }
+    list->cheats[list->cheats_len++] = *cheat;
+    cheats_apply(list);
+    return true;
+}
+
+void cheats_apply(CheatList *list) {
+    Cartridge *cart = list->cart;
+    // Start over from PRG ROM, which other banks may have replaced since
+    for (int i = 0; i < list->cheats_len; i++) {
+        const uint16_t addr = list->cheats[i].addr;
+        get_page(cart, addr)->data = (uint8_t *)get_rom(cart, addr) -
+                                     (addr & MASK_MM_PAGE);
+    }
+    for (int i = 0; i < list->cheats_len; i++) {
+        const Cheat *cheat = &list->cheats[i];
+        const uint8_t *rom = get_rom(cart, cheat->addr);
+        if (cheat->has_compare && *rom != cheat->compare) {
+            continue;
+        }
+        MemoryPage *page = get_page(cart, cheat->addr);
+        if (page->data == rom - (cheat->addr & MASK_MM_PAGE)) {
+            memcpy(list->overlays[i], page->data, MM_PAGE_SIZE);
+            page->data = list->overlays[i];
+        }
+        page->data[cheat->addr & MASK_MM_PAGE] = cheat->value;
+        // Instructions predecoded from PRG ROM would skip the patch, and
+        // those from the overlay would stay patched once switched out
+        if (cart->decoded_banks) {
+            cart->decoded_banks[(cheat->addr >> 13) & (PRG_BANKS - 1)] = NULL;
+        }
+    }
+}
@@ -0,0 +1,42 @@
+#ifndef f_cheats_h
+#define f_cheats_h
+
+#include "../common.h"
+
+#include "machine.h"
+
+#define CHEATS_MAX 32
+
+// Replaces the byte of PRG ROM read at addr, only if it was compare when
+// has_compare is set
+typedef struct Cheat {
+    uint16_t addr;
+    uint8_t value;
+    uint8_t compare;
+    bool has_compare;
+} Cheat;
+
+// Patched copies of the memory pages holding cheats, which the pages point
+// to instead of PRG ROM while the bytes compared match, so that reading
+// anything costs the same as without cheats
+typedef struct CheatList {
+    Cartridge *cart;
+    Cheat cheats[CHEATS_MAX];
+    int cheats_len;
+    uint8_t overlays[CHEATS_MAX][MM_PAGE_SIZE]; // Used by the first cheat
+                                                // of every page
+} CheatList;
+
+// Game Genie codes of 6 or 8 letters, or raw ones as ADDR:VV or ADDR?CC:VV
+// in hex
+bool cheat_decode(Cheat *cheat, const char *code);
+
+void cheats_init(CheatList *list, Machine *vm);
+void cheats_teardown(CheatList *list);
+
+bool cheats_add(CheatList *list, const Cheat *cheat);
+// Repoints the pages of the cheats to their overlays, after the banks
+// selected (and the pages pointing to them) changed
+void cheats_apply(CheatList *list);
+
+#endif /* f_cheats_h */
@@ -0,0 +1,161 @@
+#include "debugger.h"
+
+#include "profiler.h"
+#include "trace.h"
+
+// Distance between the mirrors of an address in the CPU memory map, within
+// a range that ends on the next multiple of 2000
+static int get_mirror_step(uint16_t addr) {
+    if (addr < 0x2000) {
+        return SIZE_WRAM;
+    }
+    if (addr < 0x4000) {
+        return 8;
+    }
+    return 0x2000;
+}
+
+static uint16_t get_mirror_base(uint16_t addr) {
+    if (addr < 0x4000) {
+        return (addr & 0x2000) | (addr & (get_mirror_step(addr) - 1));
+    }
+    return addr;
+}
+
+static Watchpoint *find_watchpoint(Debugger *dbg, uint16_t addr) {
+    const uint16_t base = get_mirror_base(addr);
+    for (int i = 0; i < dbg->watchpoints_len; i++) {
+        if (dbg->watchpoints[i].addr == base) {
+            return &dbg->watchpoints[i];
+        }
+    }
+    return NULL;
+}
+
+// TRAPS //
+
+static void hit(Debugger *dbg, DebugStop stop, uint16_t addr, uint8_t value) {
+    // Only the first access matters when an instruction does several
+    if (dbg->stop) {
+        return;
+    }
+    dbg->stop = stop;
+    dbg->stop_addr = addr;
+    dbg->stop_value = value;
+}
+
+static uint8_t trap_read(Machine *vm, uint16_t addr) {
+    const Watchpoint *wp = find_watchpoint(vm->debugger, addr);
+    const uint8_t value = (*wp->read)(vm, addr);
+    hit(vm->debugger, DS_READ, addr, value);
+    return value;
+}
+
+static void trap_write(Machine *vm, uint16_t addr, uint8_t value) {
+    const Watchpoint *wp = find_watchpoint(vm->debugger, addr);
+    (*wp->write)(vm, addr, value);
+    hit(vm->debugger, DS_WRITE, addr, value);
+}
+
+// Swaps the handlers of every mirror, so that memory without a watchpoint
+// is accessed exactly as before
+static void install(Debugger *dbg, const Watchpoint *wp) {
+    MemoryMap *mm = &dbg->vm->cpu_mm;
+    const int step = get_mirror_step(wp->addr);
+    const int end = (wp->addr & 0xE000) + 0x2000;
+    for (int addr = wp->addr; addr < end; addr += step) {
+        mm_map_read(mm, addr, addr,
+                    (wp->flags & WP_READ ? trap_read : wp->read));
+        mm_map_write(mm, addr, addr,
+                     (wp->flags & WP_WRITE ? trap_write : wp->write));
+    }
+}
+
+// PUBLIC FUNCTIONS //
+
+void debugger_init(Debugger *dbg, Machine *vm) {
+    memset(dbg, 0, sizeof(Debugger));
+    dbg->vm = vm;
+}
+
+void debugger_teardown(Debugger *dbg) {
+    for (int i = 0; i < dbg->watchpoints_len; i++) {
+        Watchpoint *wp = &dbg->watchpoints[i];
+        wp->flags = 0;
+        install(dbg, wp);
+    }
+    dbg->watchpoints_len = 0;
+}
+
+void debugger_set_breakpoint(Debugger *dbg, uint16_t addr, bool enabled) {
+    if (enabled) {
+        BIT_SET(dbg->breakpoints[addr >> 3], addr & 7);
+    } else {
+        BIT_CLEAR(dbg->breakpoints[addr >> 3], addr & 7);
+    }
+}
+
+// Replaces the flags of any watchpoint already there, none removes it
+bool debugger_set_watchpoint(Debugger *dbg, uint16_t addr, uint8_t flags) {
+    Watchpoint *wp = find_watchpoint(dbg, addr);
+    if (!wp) {
+        if (!flags) {
+            return true;
+        }
+        if (dbg->watchpoints_len == DEBUGGER_WATCHPOINTS) {
+            return false;
+        }
+        wp = &dbg->watchpoints[dbg->watchpoints_len++];
+        wp->addr = get_mirror_base(addr);
+        wp->read = mm_get_read(&dbg->vm->cpu_mm, wp->addr);
+        wp->write = mm_get_write(&dbg->vm->cpu_mm, wp->addr);
+    }
+    wp->flags = flags & (WP_READ | WP_WRITE);
+    install(dbg, wp);
+    if (!wp->flags) {
+        *wp = dbg->watchpoints[--dbg->watchpoints_len];
+    }
+    return true;
+}
+
+int debugger_step(Debugger *dbg, const RenderPos *pos) {
+    Machine *vm = dbg->vm;
+    CPU65xx *cpu = &vm->cpu;
+    if (BIT_CHECK(dbg->breakpoints[cpu->pc >> 3], cpu->pc & 7) &&
+        !dbg->skip_breakpoint) {
+        dbg->stop = DS_BREAKPOINT;
+        dbg->stop_addr = cpu->pc;
+        dbg->stop_value = machine_peek(vm, cpu->pc);
+    }
+    dbg->skip_breakpoint = false;
+    // Also when the PPU or APU hit a watchpoint since the last instruction
+    if (dbg->stop) {
+        dbg->stop_pc = cpu->pc;
+        dbg->pos = *pos;
+        dbg->stopped = true;
+        return 0;
+    }
+
+    dbg->stop_pc = cpu->pc;
+    int cycles;
+    if (vm->trace) {
+        cycles = trace_step(vm->trace, vm, pos);
+    } else if (vm->profiler) {
+        cycles = profiler_step(vm->profiler);
+    } else {
+        cycles = cpu_65xx_step(cpu);
+    }
+    if (dbg->stop) {
+        dbg->pos = *pos;
+        dbg->stopped = true;
+    }
+    return cycles;
+}
+
+// Clears the stop, returning where the frame was at
+RenderPos debugger_resume(Debugger *dbg) {
+    dbg->skip_breakpoint = (dbg->stop == DS_BREAKPOINT);
+    dbg->stop = DS_NONE;
+    dbg->stopped = false;
+    return dbg->pos;
+}
@@ -0,0 +1,61 @@
+#ifndef f_debugger_h
+#define f_debugger_h
+
+#include "../common.h"
+
+#include "machine.h"
+
+#define DEBUGGER_WATCHPOINTS 64
+
+typedef enum {
+    WP_READ  = 1 << 0,
+    WP_WRITE = 1 << 1,
+} WatchFlag;
+
+// Why the machine stopped, if it did
+typedef enum {
+    DS_NONE = 0,
+    DS_BREAKPOINT,
+    DS_READ,
+    DS_WRITE,
+} DebugStop;
+
+// Memory handlers replaced for the address (and its mirrors)
+typedef struct Watchpoint {
+    uint16_t addr;
+    uint8_t flags;
+    ReadFuncPtr read;
+    WriteFuncPtr write;
+} Watchpoint;
+
+typedef struct Debugger {
+    Machine *vm;
+
+    // Execution breakpoints, checked before each instruction
+    uint8_t breakpoints[0x10000 / 8];
+    Watchpoint watchpoints[DEBUGGER_WATCHPOINTS];
+    int watchpoints_len;
+
+    // Breakpoints stop before the instruction runs, watchpoints right after
+    // the instruction that accessed the memory (or before the next one for
+    // accesses by the PPU or APU). machine_advance_frame() then returns
+    // early, and the next call carries on from the same cycle.
+    DebugStop stop;
+    bool stopped;
+    RenderPos pos;
+    uint16_t stop_pc; // Instruction that hit it
+    uint16_t stop_addr;
+    uint8_t stop_value;
+    bool skip_breakpoint;
+} Debugger;
+
+void debugger_init(Debugger *dbg, Machine *vm);
+void debugger_teardown(Debugger *dbg);
+
+void debugger_set_breakpoint(Debugger *dbg, uint16_t addr, bool enabled);
+bool debugger_set_watchpoint(Debugger *dbg, uint16_t addr, uint8_t flags);
+
+int debugger_step(Debugger *dbg, const RenderPos *pos);
+RenderPos debugger_resume(Debugger *dbg);
+
+#endif /* f_debugger_h */
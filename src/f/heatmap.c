@@ -0,0 +1,120 @@
+#include "heatmap.h"
+
+static int get_prg_banks(const Cartridge *cart) {
+    return (int)(cart->prg_rom.size / SIZE_PRG_BANK);
+}
+
+static int get_chr_banks(const Cartridge *cart) {
+    return (int)(cart->chr_memory.size / SIZE_CHR_BANK);
+}
+
+static void reset_counts(Heatmap *hm) {
+    const Cartridge *cart = &hm->vm->cart;
+    memset(hm->cpu, 0, sizeof(hm->cpu));
+    memset(hm->ppu, 0, sizeof(hm->ppu));
+    for (int i = HM_READ; i <= HM_WRITE; i++) {
+        memset(hm->prg[i], 0, sizeof(uint32_t) * get_prg_banks(cart));
+        memset(hm->chr[i], 0, sizeof(uint32_t) * get_chr_banks(cart));
+    }
+}
+
+static void dump(Heatmap *hm) {
+    const Cartridge *cart = &hm->vm->cart;
+    char path[1024];
+    snprintf(path, sizeof(path), "%s.%06d.heat", hm->prefix, hm->first_frame);
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        eprintf("%s: Error opening file\n", path);
+        return;
+    }
+    HeatmapHeader header = {
+        .version = HEATMAP_VERSION,
+        .first_frame = hm->first_frame,
+        .frames = hm->next_frame - hm->first_frame,
+        .prg_banks = get_prg_banks(cart),
+        .chr_banks = get_chr_banks(cart),
+    };
+    memcpy(header.magic, HEATMAP_MAGIC, sizeof(header.magic));
+    fwrite(&header, sizeof(HeatmapHeader), 1, f);
+    fwrite(hm->cpu, sizeof(hm->cpu), 1, f);
+    fwrite(hm->ppu, sizeof(hm->ppu), 1, f);
+    for (int i = HM_READ; i <= HM_WRITE; i++) {
+        fwrite(hm->prg[i], sizeof(uint32_t), header.prg_banks, f);
+    }
+    for (int i = HM_READ; i <= HM_WRITE; i++) {
+        fwrite(hm->chr[i], sizeof(uint32_t), header.chr_banks, f);
+    }
+    if (fclose(f)) {
+        eprintf("%s: Error writing file\n", path);
+    }
+}
+
+// PUBLIC FUNCTIONS //
+
+void heatmap_init(Heatmap *hm, Machine *vm, const char *prefix, int interval) {
+    memset(hm, 0, sizeof(Heatmap));
+    hm->vm = vm;
+    hm->prefix = prefix;
+    hm->interval = interval;
+    hm->first_frame = -1;
+
+    Cartridge *cart = &vm->cart;
+    for (int i = HM_READ; i <= HM_WRITE; i++) {
+        hm->prg[i] = calloc(get_prg_banks(cart), sizeof(uint32_t));
+        hm->chr[i] = calloc(get_chr_banks(cart), sizeof(uint32_t));
+    }
+
+    // Predecoded instructions skip the memory map when run again, so stop
+    // predecoding to get every fetch counted
+    if (cart->decoded_banks) {
+        for (int i = 0; i < PRG_BANKS; i++) {
+            cart->decoded_banks[i] = NULL;
+        }
+        cart->decoded_banks = NULL;
+    }
+    // CPU blocks roll back instructions that touch I/O and run them again,
+    // fetches included, so keep them from reading anything at all rather
+    // than getting those counted twice
+    memset(vm->cpu.block_access, 0, sizeof(vm->cpu.block_access));
+}
+
+void heatmap_teardown(Heatmap *hm) {
+    if (hm->next_frame > hm->first_frame) {
+        dump(hm);
+    }
+    for (int i = HM_READ; i <= HM_WRITE; i++) {
+        free(hm->prg[i]);
+        free(hm->chr[i]);
+    }
+}
+
+void heatmap_count(Heatmap *hm, const MemoryMap *mm, uint16_t addr,
+                   HeatmapAccess access) {
+    const Cartridge *cart = &hm->vm->cart;
+    if (mm == &hm->vm->cpu_mm) {
+        hm->cpu[access][addr]++;
+        if (addr >= 0x8000) {
+            const uint8_t *bank = cart->prg_banks[(addr >> 13) &
+                                                  (PRG_BANKS - 1)];
+            hm->prg[access][(bank - cart->prg_rom.data) / SIZE_PRG_BANK]++;
+        }
+    } else {
+        hm->ppu[access][addr]++;
+        if (addr < 0x2000) {
+            const uint8_t *bank = cart->chr_banks[(addr >> 10) &
+                                                  (CHR_BANKS - 1)];
+            hm->chr[access][(bank - cart->chr_memory.data) / SIZE_CHR_BANK]++;
+        }
+    }
+}
+
+void heatmap_frame(Heatmap *hm, int frame) {
+    if (hm->first_frame < 0) {
+        hm->first_frame = frame;
+    } else if (frame - hm->first_frame >= hm->interval) {
+        dump(hm);
+        reset_counts(hm);
+        hm->first_frame = frame;
+    }
+    hm->next_frame = frame + 1;
+}
@@ -0,0 +1,55 @@
+#ifndef f_heatmap_h
+#define f_heatmap_h
+
+#include "../common.h"
+
+#include "machine.h"
+
+#define HEATMAP_MAGIC "FHMP"
+#define HEATMAP_VERSION 1
+#define HEATMAP_DEFAULT_INTERVAL 60
+
+#define HEATMAP_PPU_SIZE 0x4000
+
+typedef enum {
+    HM_READ,
+    HM_WRITE,
+} HeatmapAccess;
+
+// Each dump is this header followed by arrays of uint32_t counts, reads
+// then writes for each: every CPU address, every PPU address, every 8kB
+// bank of PRG ROM and every 1kB bank of CHR ROM/RAM
+typedef struct HeatmapHeader {
+    char magic[4];
+    uint16_t version;
+    uint16_t padding;
+    int32_t first_frame; // Counted from that frame...
+    int32_t frames;      // ...for as many frames
+    uint32_t prg_banks;
+    uint32_t chr_banks;
+} HeatmapHeader;
+
+// Counts of accesses through the memory maps, only made when built with
+// HEATMAP defined, dumped to a new file every interval frames
+typedef struct Heatmap {
+    Machine *vm;
+    const char *prefix;
+    int interval;
+    int first_frame; // -1 until the first frame
+    int next_frame;
+    uint32_t cpu[2][0x10000];
+    uint32_t ppu[2][HEATMAP_PPU_SIZE];
+    uint32_t *prg[2];
+    uint32_t *chr[2];
+} Heatmap;
+
+void heatmap_init(Heatmap *hm, Machine *vm, const char *prefix, int interval);
+// Dumps whatever was counted since the last dump
+void heatmap_teardown(Heatmap *hm);
+
+void heatmap_count(Heatmap *hm, const MemoryMap *mm, uint16_t addr,
+                   HeatmapAccess access);
+// Called at the start of every frame
+void heatmap_frame(Heatmap *hm, int frame);
+
+#endif /* f_heatmap_h */
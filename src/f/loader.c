@@ -2,8 +2,14 @@
 
 #include "../crc32.h"
 #include "../driver.h"
+#include "analysis.h"
 #include "cartridge.h"
+#include "cdl.h"
+#include "cheats.h"
+#include "heatmap.h"
 #include "machine.h"
+#include "romdb.h"
+#include "trace.h"
 
 int ines_loader(Driver *driver, blob *rom) {
     FCartInfo cart;
@@ -25,19 +31,20 @@ int ines_loader(Driver *driver, blob *rom) {
     }
     
     cart.prg_rom.data = rom->data + HEADER_SIZE;
-    uint32_t crc = crc32(&cart.prg_rom);
-    eprintf("PRG ROM: %zuKB (%08X)\n", cart.prg_rom.size >> 10, crc);
+    const uint32_t prg_crc = crc32(&cart.prg_rom);
+    eprintf("PRG ROM: %zuKB (%08X)\n", cart.prg_rom.size >> 10, prg_crc);
     
     eprintf("CHR ROM: ");
+    uint32_t rom_crc = prg_crc;
     if (cart.chr_rom.size) {
         cart.chr_rom.data = cart.prg_rom.data + cart.prg_rom.size;
         eprintf("%zuKB (%08X)\n",
                 cart.chr_rom.size >> 10, crc32(&cart.chr_rom));
         blob combined = {.data = cart.prg_rom.data,
                          .size = cart.prg_rom.size + cart.chr_rom.size};
-        crc = crc32(&combined);
+        rom_crc = crc32(&combined);
         eprintf("Combined ROMs: %zuKB (%08X)\n",
-                combined.size >> 10, crc);
+                combined.size >> 10, rom_crc);
     } else {
         eprintf("None (uses RAM instead)\n");
     }
@@ -74,10 +81,91 @@ int ines_loader(Driver *driver, blob *rom) {
     driver->screen_h = HEIGHT_CROPPED;
     Machine *vm = malloc(sizeof(Machine));
     machine_init(vm, &cart, driver);
+    vm->dbg_map = driver->dbg_map;
+
+    // Cycle-exact emulation only for the games that need it, as listed in
+    // the ROM database or else guessed, unless TIER says otherwise
+    uint8_t needs;
+    const bool is_listed = romdb_lookup(rom_crc, &needs);
+    if (!is_listed) {
+        needs = romdb_guess(vm);
+    }
+    vm->tier = (needs ? TIER_ACCURATE : TIER_FAST);
+    const char *tier = getenv("TIER");
+    if (tier && !strcmp(tier, "fast")) {
+        vm->tier = TIER_FAST;
+    } else if (tier && !strcmp(tier, "accurate")) {
+        vm->tier = TIER_ACCURATE;
+    } else if (tier && *tier) {
+        eprintf("%s: Unknown tier\n", tier);
+    }
+    eprintf("Accuracy: %s (%s%s%s%s)\n",
+            (vm->tier == TIER_FAST ? "Fast" : "Accurate"),
+            (is_listed ? "listed" : "guessed"),
+            (needs & RN_MIDLINE ? ", mid-scanline effects" : ""),
+            (needs & RN_SPRITE0 ? ", sprite 0 timing" : ""),
+            (needs & RN_DMC ? ", DMC cycle stealing" : ""));
     driver->vm = vm;
+
+    // Game Genie (or raw) codes, separated by commas or spaces
+    const char *codes = getenv("CHEATS");
+    if (codes) {
+        vm->cart.cheats = malloc(sizeof(CheatList));
+        cheats_init(vm->cart.cheats, vm);
+        char *codes_copy = strdup(codes);
+        for (char *code = strtok(codes_copy, ", "); code;
+             code = strtok(NULL, ", ")) {
+            Cheat cheat;
+            if (!cheat_decode(&cheat, code)) {
+                eprintf("%s: Invalid cheat code\n", code);
+            } else if (!cheats_add(vm->cart.cheats, &cheat)) {
+                eprintf("%s: Too many cheat codes\n", code);
+            }
+        }
+        free(codes_copy);
+        eprintf("Cheats: %d\n", vm->cart.cheats->cheats_len);
+    }
+
+    // Code/data log, accumulated across runs in the same file
+    const char *cdl_path = getenv("CDL");
+    if (cdl_path) {
+        vm->cdl = malloc(sizeof(CodeDataLogger));
+        cdl_init(vm->cdl, vm, cdl_path);
+    }
+
+    // Static analysis of the code, cached by PRG ROM checksum
+    const char *analyze = getenv("ANALYZE");
+    if (analyze && *analyze && strcmp(analyze, "0")) {
+        vm->analysis = malloc(sizeof(CodeAnalysis));
+        analysis_init(vm->analysis, vm, prg_crc);
+    }
+
+#ifdef HEATMAP
+    // Access counts, dumped every HEATMAP_FRAMES frames
+    const char *heatmap_prefix = getenv("HEATMAP");
+    if (heatmap_prefix) {
+        const char *frames = getenv("HEATMAP_FRAMES");
+        const int interval = (frames ? atoi(frames) : 0);
+        vm->heatmap = malloc(sizeof(Heatmap));
+        heatmap_init(vm->heatmap, vm, heatmap_prefix,
+                     (interval > 0 ? interval : HEATMAP_DEFAULT_INTERVAL));
+    }
+#endif
+
+    // Binary instruction trace, see f-type-trace for reading it back
+    const char *trace_path = getenv("TRACE");
+    if (trace_path) {
+        vm->trace = malloc(sizeof(Trace));
+        if (!trace_init(vm->trace, trace_path)) {
+            eprintf("%s: Error opening file\n", trace_path);
+            free(vm->trace);
+            vm->trace = NULL;
+        }
+    }
     driver->refresh_rate = REFRESH_RATE;
     driver->screens[0] = vm->ppu.screens[0];
     driver->screens[1] = vm->ppu.screens[1];
+    driver->screen_size = vm->ppu.screen_size;
     driver->advance_frame_func = (AdvanceFrameFuncPtr)machine_advance_frame;
     driver->teardown_func = f_teardown;
     return 0;
@@ -85,6 +173,30 @@ int ines_loader(Driver *driver, blob *rom) {
 
 void f_teardown(Driver *driver) {
     Machine *vm = driver->vm;
+    if (vm->trace) {
+        trace_teardown(vm->trace);
+        free(vm->trace);
+    }
+    if (vm->cart.cheats) {
+        CheatList *cheats = vm->cart.cheats;
+        cheats_teardown(cheats);
+        free(cheats);
+    }
+    if (vm->heatmap) {
+        heatmap_teardown(vm->heatmap);
+        free(vm->heatmap);
+    }
+    if (vm->cdl) {
+        if (!cdl_save(vm->cdl)) {
+            eprintf("%s: Error writing file\n", vm->cdl->path);
+        }
+        cdl_teardown(vm->cdl);
+        free(vm->cdl);
+    }
+    if (vm->analysis) {
+        analysis_teardown(vm->analysis);
+        free(vm->analysis);
+    }
     machine_teardown(vm);
     free(driver->vm);
 }
@@ -1,7 +1,11 @@
 #include "machine.h"
 
 #include "../driver.h"
+#include "debugger.h"
+#include "heatmap.h"
 #include "loader.h"
+#include "profiler.h"
+#include "trace.h"
 
 void machine_init(Machine *vm, FCartInfo *carti, Driver *driver) {
     memset(vm, 0, sizeof(Machine));
@@ -16,7 +20,13 @@ void machine_init(Machine *vm, FCartInfo *carti, Driver *driver) {
     memory_map_ppu_init(&vm->ppu_mm, vm);
     cpu_65xx_init(&vm->cpu, &vm->cpu_mm, (CPU65xxReadFuncPtr)mm_read,
                                          (CPU65xxWriteFuncPtr)mm_write);
-    ppu_init(&vm->ppu, &vm->ppu_mm, &vm->cpu, &driver->input.lightgun_pos);
+    // WRAM can be accessed by CPU blocks, PRG ROM is added by mapper_init()
+    memset(vm->cpu.block_access, BA_READ | BA_WRITE, 0x2000 >> 8);
+    // PPUSTATUS too when it is known not to change, for busy-wait loops
+    vm->cpu.block_poll_mask = 0xE007;
+    vm->cpu.block_poll_addr = 0x2002;
+    ppu_init(&vm->ppu, &vm->ppu_mm, &vm->cpu, &driver->input.lightgun_pos,
+             driver->screen_format);
     apu_init(&vm->apu, &vm->cpu, driver->audio_buffer, &driver->audio_pos);
     
     if (!vm->cart.chr_memory.size) {
@@ -29,7 +39,7 @@ void machine_init(Machine *vm, FCartInfo *carti, Driver *driver) {
     machine_set_nt_mirroring(vm, carti->default_mirroring);
     mapper_init(vm, carti->mapper_id);
     
-    cpu_65xx_reset(&vm->cpu, false);
+    cpu_65xx_reset(&vm->cpu);
 }
 
 void machine_teardown(Machine *vm) {
@@ -41,51 +51,152 @@ void machine_teardown(Machine *vm) {
     if (vm->cart.chr_is_ram) {
         free(vm->cart.chr_memory.data);
     }
+    
+    free(vm->cart.prg_decoded);
+    
+    ppu_teardown(&vm->ppu);
+    memory_map_teardown(&vm->cpu_mm);
+    memory_map_teardown(&vm->ppu_mm);
 }
 
-void machine_advance_frame(Machine *vm, int frame, bool verbose) {
-    vm->ppu.current_screen = frame & 1;
-    
+// Furthest a CPU block can run ahead, in CPU cycles: up to the PPU raising
+// the vblank NMI, and never past the end of the frame
+static int get_cpu_block_horizon(const RenderPos *pos) {
+    const int nmi_clk = 242 * PPU_CYCLES_PER_SCANLINE + 1;
+    const int end_clk = PPU_SCANLINES_PER_FRAME * PPU_CYCLES_PER_SCANLINE - 1;
+    int clk = (pos->scanline + 1) * PPU_CYCLES_PER_SCANLINE + pos->cycle;
+    return ((clk <= nmi_clk ? nmi_clk : end_clk) - clk) / T_CPU_MULTIPLIER;
+}
+
+// Whether an IRQ line may be raised without the CPU writing to a register
+static bool can_raise_irq(Machine *vm) {
+    const int apu_flags = vm->apu.flags;
+    return !(BIT_CHECK(apu_flags, AF_FC_IRQ_DISABLE) ||
+             BIT_CHECK(apu_flags, AF_FC_DIVIDER)) ||
+           (BIT_CHECK(apu_flags, AF_DMC_IRQ_ENABLE) && vm->apu.dmc_remain) ||
+           (vm->cart.mapper_irq_enabled && *vm->cart.mapper_irq_enabled);
+}
+
+// Whether the PPU can render the scanline at pos all at once, after the CPU
+// is done with it: mapper IRQs count PPU fetches as they happen, and the
+// debugger can stop anywhere
+static bool can_defer_ppu(Machine *vm, const RenderPos *pos) {
+    return pos->scanline >= 0 && pos->scanline < HEIGHT_REAL &&
+           !pos->cycle && !vm->cart.mapper_irq_enabled && !vm->debugger;
+}
+
+// Runs everything the APU would have done on the PPU cycles until end
+static void catch_up_apu(Machine *vm, uint64_t end) {
+    uint64_t step = vm->mclk + (T_APU_MULTIPLIER - vm->mclk % T_APU_MULTIPLIER) %
+                               T_APU_MULTIPLIER;
+    uint64_t sample = vm->mclk + (T_SAMPLE_MULTIPLIER -
+                                  vm->mclk % T_SAMPLE_MULTIPLIER) %
+                                 T_SAMPLE_MULTIPLIER;
+    while (step < end || sample < end) {
+        if (step < end && step <= sample) {
+            apu_step(&vm->apu);
+            step += T_APU_MULTIPLIER;
+        } else {
+            apu_sample(&vm->apu);
+            sample += T_SAMPLE_MULTIPLIER;
+        }
+    }
+}
+
+// Fast tier: the CPU runs a whole scanline ahead of the PPU, so that what
+// it does shows up on the next scanline at best, then the APU catches up
+static void advance_frame_fast(Machine *vm) {
+    RenderPos pos = {-1, 0};
+    do {
+        // Nothing else runs until the end of the scanline, so interrupts
+        // can't come up in the middle of a block
+        vm->cpu.block_irq = false;
+        vm->cpu.block_poll = ppu_is_status_stable(&vm->ppu, &pos);
+        while (vm->cpu_wait < PPU_CYCLES_PER_SCANLINE) {
+            const int horizon = (PPU_CYCLES_PER_SCANLINE - vm->cpu_wait) /
+                                T_CPU_MULTIPLIER;
+            vm->cpu_wait += cpu_65xx_run(&vm->cpu, horizon) *
+                            T_CPU_MULTIPLIER;
+        }
+
+        ppu_step_scanline(&vm->ppu, pos.scanline);
+
+        const uint64_t end = vm->mclk + PPU_CYCLES_PER_SCANLINE;
+        catch_up_apu(vm, end);
+        vm->mclk = end;
+        vm->cpu_wait -= PPU_CYCLES_PER_SCANLINE;
+    } while (++pos.scanline < (PPU_SCANLINES_PER_FRAME - 1));
+}
+
+void machine_advance_frame(Machine *vm, int frame) {
+#ifdef HEATMAP
+    if (vm->heatmap) {
+        heatmap_frame(vm->heatmap, frame);
+    }
+#endif
+    if (vm->tier == TIER_FAST &&
+        !vm->debugger && !vm->trace && !vm->profiler) {
+        vm->ppu.current_screen = frame & 1;
+        advance_frame_fast(vm);
+        return;
+    }
+
     // TODO: Skip last cycle of the pre-render line on odd frames
     RenderPos pos = {-1, 0};
+    if (vm->debugger && vm->debugger->stopped) {
+        pos = debugger_resume(vm->debugger);
+    } else {
+        vm->ppu.current_screen = frame & 1;
+    }
     do {
+        // Accessing anything the PPU depends on brings it back to stepping
+        // cycle by cycle, for the rest of the scanline
+        PPU *ppu = &vm->ppu;
+        if (can_defer_ppu(vm, &pos)) {
+            ppu->is_deferred = true;
+            ppu->deferred_scanline = pos.scanline;
+            ppu->deferred_mclk = vm->mclk;
+        }
         do {
             if (!vm->cpu_wait) {
-                // Check for debug label
-                bool is_endless_loop = false;
-                if (verbose && vm->dbg_map) {
-                    int i = 0;
-                    while (vm->dbg_map[i].label[0]) {
-                        if (vm->dbg_map[i].addr == vm->cpu.pc) {
-                            const char *label = vm->dbg_map[i].label;
-                            if (strcmp(label, "EndlessLoop")) {
-                                printf(":%s\n", vm->dbg_map[i].label);
-                            } else {
-                                is_endless_loop = true;
-                            }
-                            break;
-                        }
-                        i++;
+                if (vm->debugger) {
+                    vm->cpu_wait = debugger_step(vm->debugger, &pos);
+                    if (vm->debugger->stopped) {
+                        // Nothing else has run on this cycle yet
+                        vm->cpu_wait *= T_CPU_MULTIPLIER;
+                        return;
                     }
+                } else if (vm->trace) {
+                    vm->cpu_wait = trace_step(vm->trace, vm, &pos);
+                } else if (vm->profiler) {
+                    vm->cpu_wait = profiler_step(vm->profiler);
+                } else {
+                    vm->cpu.block_irq = can_raise_irq(vm);
+                    vm->cpu.block_poll = ppu_is_status_stable(&vm->ppu, &pos);
+                    vm->cpu_wait = cpu_65xx_run(&vm->cpu,
+                                                get_cpu_block_horizon(&pos));
                 }
-                vm->cpu_wait = cpu_65xx_step(&vm->cpu,
-                                             verbose && !is_endless_loop) *
-                               T_CPU_MULTIPLIER;
+                vm->cpu_wait *= T_CPU_MULTIPLIER;
             }
             
             if (!(vm->mclk % T_APU_MULTIPLIER)) {
                 apu_step(&vm->apu);
             }
-            // Yeah this needs to be done better
-            if (!(vm->mclk % 121)) {
+            if (!(vm->mclk % T_SAMPLE_MULTIPLIER)) {
                 apu_sample(&vm->apu);
             }
 
-            ppu_step(&vm->ppu, &pos, verbose);
+            if (!ppu->is_deferred) {
+                ppu_step(ppu, &pos);
+            }
             
             ++vm->mclk;
             --vm->cpu_wait;
         } while (++pos.cycle < PPU_CYCLES_PER_SCANLINE);
+        if (ppu->is_deferred) {
+            ppu->is_deferred = false;
+            ppu_step_scanline(ppu, pos.scanline);
+        }
         pos.cycle = 0;
     } while (++pos.scanline < (PPU_SCANLINES_PER_FRAME - 1));
 }
@@ -102,9 +213,42 @@ void machine_set_nt_mirroring(Machine *vm, NametableMirroring nm) {
     for (int i = 0; i < 4; i++) {
         vm->nt_layout[i] = vm->nametables[layout[i]];
     }
+    machine_map_nametables(vm);
+}
+
+void machine_map_nametables(Machine *vm) {
+    // 2000-3EFF, 3000 onwards repeating 2000
+    for (int addr = 0x2000; addr < 0x3F00; addr += MM_PAGE_SIZE) {
+        vm->ppu_mm.pages[addr >> MM_PAGE_SHIFT].data =
+            vm->nt_layout[(addr >> 10) & 3] + (addr & MASK_NAMETABLE);
+    }
 }
 
 void machine_stall_cpu(Machine *vm, int cycles) {
     // TODO: +1 if on a odd CPU cycle
     vm->cpu_wait += cycles * T_CPU_MULTIPLIER;
 }
+
+void machine_sync_ppu(Machine *vm) {
+    PPU *ppu = &vm->ppu;
+    ppu->is_deferred = false;
+    RenderPos pos = {ppu->deferred_scanline, 0};
+    for (; pos.cycle < (int)(vm->mclk - ppu->deferred_mclk); pos.cycle++) {
+        ppu_step(ppu, &pos);
+    }
+}
+
+// Read CPU memory without any side effect, only where it is plain memory
+uint8_t machine_peek(Machine *vm, uint16_t addr) {
+    if (addr < 0x2000) {
+        return vm->wram[addr & MASK_WRAM];
+    }
+    if (addr >= 0x8000) {
+        return vm->cart.prg_banks[(addr >> 13) & (PRG_BANKS - 1)]
+                                 [addr & MASK_PRG_BANK];
+    }
+    if (addr >= 0x6000 && vm->cart.sram.data) {
+        return vm->cart.sram.data[addr & MASK_SRAM];
+    }
+    return 0;
+}
@@ -22,11 +22,19 @@
 // Timing constants
 #define T_CPU_MULTIPLIER 3
 #define T_APU_MULTIPLIER 6
+#define T_SAMPLE_MULTIPLIER 121 // Yeah this needs to be done better
 
 // Forward decalarations
+typedef struct CodeAnalysis CodeAnalysis;
+typedef struct CodeDataLogger CodeDataLogger;
+typedef struct DebugMap DebugMap;
+typedef struct Debugger Debugger;
 typedef struct Driver Driver;
 typedef struct FCartInfo FCartInfo;
+typedef struct Heatmap Heatmap;
 typedef struct InputState InputState;
+typedef struct Profiler Profiler;
+typedef struct Trace Trace;
 
 // IRQ bits
 typedef enum {
@@ -35,10 +43,10 @@ typedef enum {
     IRQ_MAPPER,
 } IRQFlag;
 
-typedef struct {
-    uint16_t addr;
-    char label[256];
-} DebugMap;
+typedef enum {
+    TIER_ACCURATE = 0, // CPU, PPU and APU interleaved on every PPU cycle
+    TIER_FAST,         // CPU and APU only caught up once per scanline
+} AccuracyTier;
 
 typedef struct Machine {
     CPU65xx cpu;
@@ -48,7 +56,14 @@ typedef struct Machine {
     MemoryMap ppu_mm;
     Cartridge cart;
     
-    const DebugMap *dbg_map;
+    const DebugMap *dbg_map; // NULL unless given
+    CodeAnalysis *analysis; // NULL unless enabled
+    CodeDataLogger *cdl; // NULL unless enabled
+    Heatmap *heatmap; // Same, and only ever enabled in HEATMAP builds
+    // Run the CPU instead of blocks when set
+    Debugger *debugger;
+    Profiler *profiler;
+    Trace *trace;
     
     // System RAM
     uint8_t wram[SIZE_WRAM];
@@ -60,6 +75,7 @@ typedef struct Machine {
     InputState *input;
     
     // Time tracking
+    AccuracyTier tier; // Always accurate while any of the above is set
     uint64_t mclk; // "Master" clock (actually PPU clock)
     int cpu_wait;
 } Machine;
@@ -75,10 +91,17 @@ typedef enum {
 void machine_init(Machine *vm, FCartInfo *carti, Driver *driver);
 void machine_teardown(Machine *vm);
 
-void machine_advance_frame(Machine *vm, int frame, bool verbose);
+// Returns early when the debugger stops, the next call resumes the frame
+void machine_advance_frame(Machine *vm, int frame);
 
 void machine_set_nt_mirroring(Machine *vm, NametableMirroring m);
+// Points PPU memory at nt_layout, whenever it changed
+void machine_map_nametables(Machine *vm);
 
 void machine_stall_cpu(Machine *vm, int cycles);
+// Catches up with a deferred PPU scanline, up to the current cycle
+void machine_sync_ppu(Machine *vm);
+
+uint8_t machine_peek(Machine *vm, uint16_t addr);
 
 #endif /* f_machine_h */
@@ -1,12 +1,73 @@
 #include "memory_maps.h"
 
 #include "../input.h"
+#include "heatmap.h"
 #include "machine.h"
 #include "ppu.h"
 
-static void init_common(MemoryMap *mm, Machine *vm) {
+static void init_common(MemoryMap *mm, Machine *vm, ReadFuncPtr read_data,
+                        WriteFuncPtr write_data) {
     memset(mm, 0, sizeof(MemoryMap));
     mm->vm = vm;
+    mm->read_data = read_data;
+    mm->write_data = write_data;
+}
+
+// Back to one handler when all the ones per address ended up the same, so
+// that plain memory can be accessed directly again
+static void update_page(MemoryMap *mm, MemoryPage *page) {
+    if (page->reads) {
+        int i = 1;
+        while (i < MM_PAGE_SIZE && page->reads[i] == page->reads[0]) {
+            i++;
+        }
+        if (i == MM_PAGE_SIZE) {
+            page->read = page->reads[0];
+            free(page->reads);
+            page->reads = NULL;
+        }
+    }
+    if (page->writes) {
+        int i = 1;
+        while (i < MM_PAGE_SIZE && page->writes[i] == page->writes[0]) {
+            i++;
+        }
+        if (i == MM_PAGE_SIZE) {
+            page->write = page->writes[0];
+            free(page->writes);
+            page->writes = NULL;
+        }
+    }
+    page->direct_read = (page->data && !page->reads &&
+                         page->read == mm->read_data);
+    page->direct_write = (page->data && !page->writes &&
+                          page->write == mm->write_data);
+}
+
+static ReadFuncPtr *get_page_reads(MemoryPage *page) {
+    if (!page->reads) {
+        page->reads = malloc(sizeof(ReadFuncPtr) * MM_PAGE_SIZE);
+        for (int i = 0; i < MM_PAGE_SIZE; i++) {
+            page->reads[i] = page->read;
+        }
+    }
+    return page->reads;
+}
+
+static WriteFuncPtr *get_page_writes(MemoryPage *page) {
+    if (!page->writes) {
+        page->writes = malloc(sizeof(WriteFuncPtr) * MM_PAGE_SIZE);
+        for (int i = 0; i < MM_PAGE_SIZE; i++) {
+            page->writes[i] = page->write;
+        }
+    }
+    return page->writes;
+}
+
+// Last address of the range within the page of addr
+static int get_page_last(int addr, uint16_t last) {
+    const int page_last = addr | MASK_MM_PAGE;
+    return (page_last < last ? page_last : last);
 }
 
 static void write_open_bus(Machine *vm, uint16_t addr, uint8_t value) {
@@ -19,14 +80,19 @@ static uint8_t read_cpu_open_bus(Machine *vm, uint16_t addr) {
     return vm->cpu_mm.last_read;
 }
 
-static uint8_t read_wram(Machine *vm, uint16_t addr) {
-    return vm->wram[addr & MASK_WRAM];
+static uint8_t read_cpu_memory(Machine *vm, uint16_t addr) {
+    const MemoryPage *page = &vm->cpu_mm.pages[addr >> MM_PAGE_SHIFT];
+    return page->data[addr & MASK_MM_PAGE];
 }
-static void write_wram(Machine *vm, uint16_t addr, uint8_t value) {
-    vm->wram[addr & MASK_WRAM] = value;
+static void write_cpu_memory(Machine *vm, uint16_t addr, uint8_t value) {
+    const MemoryPage *page = &vm->cpu_mm.pages[addr >> MM_PAGE_SHIFT];
+    page->data[addr & MASK_MM_PAGE] = value;
 }
 
 static uint8_t read_controllers(Machine *vm, uint16_t addr) {
+    if (vm->ppu.is_deferred) {
+        machine_sync_ppu(vm); // For the lightgun sensor
+    }
     int port = addr & 1;
     uint8_t value = vm->cpu_mm.last_read & 0b11100000;
     value += vm->ctrl_latch[port] & 1;
@@ -51,61 +117,155 @@ static uint8_t read_ppu_open_bus(Machine *vm, uint16_t addr) {
     return vm->ppu_mm.last_read;
 }
 
-static uint8_t read_nametables(Machine *vm, uint16_t addr) {
-    return vm->nt_layout[(addr >> 10) & 3][addr & MASK_NAMETABLE];
+static uint8_t read_ppu_memory(Machine *vm, uint16_t addr) {
+    const MemoryPage *page = &vm->ppu_mm.pages[addr >> MM_PAGE_SHIFT];
+    return page->data[addr & MASK_MM_PAGE];
 }
-static void write_nametables(Machine *vm, uint16_t addr, uint8_t value) {
-    vm->nt_layout[(addr >> 10) & 3][addr & MASK_NAMETABLE] = value;
+static void write_ppu_memory(Machine *vm, uint16_t addr, uint8_t value) {
+    const MemoryPage *page = &vm->ppu_mm.pages[addr >> MM_PAGE_SHIFT];
+    page->data[addr & MASK_MM_PAGE] = value;
 }
 
 // PUBLIC FUNCTIONS //
 
 void memory_map_cpu_init(MemoryMap *mm, Machine *vm) {
-    init_common(mm, vm);
+    init_common(mm, vm, read_cpu_memory, write_cpu_memory);
     mm->addr_mask = 0xFFFF;
     
-    for (int i = 0; i < 0x10000; i++) {
-        mm->read[i] = read_cpu_open_bus;
-        mm->write[i] = write_open_bus;
-    }
+    mm_map_read(mm, 0x0000, 0xFFFF, read_cpu_open_bus);
+    mm_map_write(mm, 0x0000, 0xFFFF, write_open_bus);
     
     // Populate the address map
     // 0000-1FFF: WRAM (2kB, repeated)
-    for (int i = 0; i < 0x2000; i++) {
-        mm->read[i] = read_wram;
-        mm->write[i] = write_wram;
-    }
+    mm_map_memory(mm, 0x0000, 0x1FFF, vm->wram, SIZE_WRAM, true);
     // 2000-4015: PPU and APU registers, defined by their respective inits
     // 4016-4017: Controller I/O
-    mm->read[0x4016] = mm->read[0x4017] = read_controllers;
-    mm->write[0x4016] = write_controller_latch;
+    mm_map_read(mm, 0x4016, 0x4017, read_controllers);
+    mm_map_write(mm, 0x4016, 0x4016, write_controller_latch);
     // 4018-401F: Test mode registers, not implemented
     // 4020-FFFF: Cartridge I/O, defined by the mapper's init
 }
 
 void memory_map_ppu_init(MemoryMap *mm, Machine *vm) {
-    init_common(mm, vm);
+    init_common(mm, vm, read_ppu_memory, write_ppu_memory);
     mm->addr_mask = 0x3FFF;
     
-    for (int i = 0; i < 0x10000; i++) {
-        mm->read[i] = read_ppu_open_bus;
-        mm->write[i] = write_open_bus;
-    }
+    mm_map_read(mm, 0x0000, 0xFFFF, read_ppu_open_bus);
+    mm_map_write(mm, 0x0000, 0xFFFF, write_open_bus);
     
     // Populate the address map
     // 0000-1FFF: Cartridge I/O, defined by the mapper's init
-    // 2000-3EFF: Nametables
-    for (int i = 0x2000; i < 0x3F00; i++) {
-        mm->read[i] = read_nametables;
-        mm->write[i] = write_nametables;
-    }
+    // 2000-3EFF: Nametables, laid out by machine_set_nt_mirroring()
+    mm_map_memory(mm, 0x2000, 0x3EFF, vm->nametables[0], SIZE_NAMETABLE,
+                  true);
     // 3F00-3FFF: Palettes, defined by ppu_init()
     // 4000-FFFF: Over the 14 bit range
 }
 
+void memory_map_teardown(MemoryMap *mm) {
+    for (int i = 0; i < MM_PAGES; i++) {
+        free(mm->pages[i].reads);
+        free(mm->pages[i].writes);
+    }
+}
+
+void mm_map_read(MemoryMap *mm, uint16_t first, uint16_t last,
+                 ReadFuncPtr func) {
+    for (int addr = first; addr <= last; addr = (addr | MASK_MM_PAGE) + 1) {
+        MemoryPage *page = &mm->pages[addr >> MM_PAGE_SHIFT];
+        const int page_last = get_page_last(addr, last);
+        if (!(addr & MASK_MM_PAGE) && page_last == (addr | MASK_MM_PAGE)) {
+            free(page->reads);
+            page->reads = NULL;
+            page->read = func;
+        } else {
+            ReadFuncPtr *reads = get_page_reads(page);
+            for (int i = addr; i <= page_last; i++) {
+                reads[i & MASK_MM_PAGE] = func;
+            }
+        }
+        update_page(mm, page);
+    }
+}
+
+void mm_map_write(MemoryMap *mm, uint16_t first, uint16_t last,
+                  WriteFuncPtr func) {
+    for (int addr = first; addr <= last; addr = (addr | MASK_MM_PAGE) + 1) {
+        MemoryPage *page = &mm->pages[addr >> MM_PAGE_SHIFT];
+        const int page_last = get_page_last(addr, last);
+        if (!(addr & MASK_MM_PAGE) && page_last == (addr | MASK_MM_PAGE)) {
+            free(page->writes);
+            page->writes = NULL;
+            page->write = func;
+        } else {
+            WriteFuncPtr *writes = get_page_writes(page);
+            for (int i = addr; i <= page_last; i++) {
+                writes[i & MASK_MM_PAGE] = func;
+            }
+        }
+        update_page(mm, page);
+    }
+}
+
+void mm_map_reads(MemoryMap *mm, uint16_t first, uint16_t last,
+                  const ReadFuncPtr *funcs) {
+    for (int addr = first; addr <= last; addr = (addr | MASK_MM_PAGE) + 1) {
+        MemoryPage *page = &mm->pages[addr >> MM_PAGE_SHIFT];
+        const int page_last = get_page_last(addr, last);
+        ReadFuncPtr *reads = get_page_reads(page);
+        for (int i = addr; i <= page_last; i++) {
+            reads[i & MASK_MM_PAGE] = funcs[i - first];
+        }
+        update_page(mm, page);
+    }
+}
+
+ReadFuncPtr mm_get_read(const MemoryMap *mm, uint16_t addr) {
+    const MemoryPage *page = &mm->pages[addr >> MM_PAGE_SHIFT];
+    return (page->reads ? page->reads[addr & MASK_MM_PAGE] : page->read);
+}
+
+WriteFuncPtr mm_get_write(const MemoryMap *mm, uint16_t addr) {
+    const MemoryPage *page = &mm->pages[addr >> MM_PAGE_SHIFT];
+    return (page->writes ? page->writes[addr & MASK_MM_PAGE] : page->write);
+}
+
+void mm_map_memory(MemoryMap *mm, uint16_t first, uint16_t last,
+                   uint8_t *data, int size, bool is_writable) {
+    for (int addr = first; addr <= last; addr += MM_PAGE_SIZE) {
+        mm->pages[addr >> MM_PAGE_SHIFT].data = data + (addr - first) % size;
+    }
+    mm_map_read(mm, first, last, mm->read_data);
+    if (is_writable) {
+        mm_map_write(mm, first, last, mm->write_data);
+    }
+}
+
+void mm_set_banks(MemoryPage *pages, uint8_t *const *banks, int banks_len,
+                  int bank_size) {
+    const int bank_pages = bank_size >> MM_PAGE_SHIFT;
+    for (int i = 0; i < banks_len * bank_pages; i++) {
+        pages[i].data = banks[i / bank_pages] +
+                        ((i % bank_pages) << MM_PAGE_SHIFT);
+    }
+}
+
+// Plain memory is accessed right away, I/O through the handlers
 uint8_t mm_read(MemoryMap *mm, uint16_t addr) {
     addr &= mm->addr_mask;
-    mm->last_read = (mm->read[addr])(mm->vm, addr);
+    const MemoryPage *page = &mm->pages[addr >> MM_PAGE_SHIFT];
+#ifdef HEATMAP
+    if (mm->vm->heatmap) {
+        heatmap_count(mm->vm->heatmap, mm, addr, HM_READ);
+    }
+#endif
+    if (page->direct_read) {
+        mm->last_read = page->data[addr & MASK_MM_PAGE];
+    } else if (page->reads) {
+        mm->last_read = (*page->reads[addr & MASK_MM_PAGE])(mm->vm, addr);
+    } else {
+        mm->last_read = (*page->read)(mm->vm, addr);
+    }
     return mm->last_read;
 }
 uint16_t mm_read_word(MemoryMap *mm, uint16_t addr) {
@@ -114,7 +274,26 @@ uint16_t mm_read_word(MemoryMap *mm, uint16_t addr) {
 
 void mm_write(MemoryMap *mm, uint16_t addr, uint8_t value) {
     addr &= mm->addr_mask;
-    (mm->write[addr])(mm->vm, addr, value);
+    const MemoryPage *page = &mm->pages[addr >> MM_PAGE_SHIFT];
+#ifdef HEATMAP
+    if (mm->vm->heatmap) {
+        heatmap_count(mm->vm->heatmap, mm, addr, HM_WRITE);
+    }
+#endif
+    if (page->direct_write) {
+        page->data[addr & MASK_MM_PAGE] = value;
+        return;
+    }
+    // Any register but the sound ones could change what the PPU renders
+    if (mm->vm->ppu.is_deferred &&
+        (addr < 0x4000 || addr >= 0x4018 || addr == 0x4014 || addr == 0x4016)) {
+        machine_sync_ppu(mm->vm);
+    }
+    if (page->writes) {
+        (*page->writes[addr & MASK_MM_PAGE])(mm->vm, addr, value);
+    } else {
+        (*page->write)(mm->vm, addr, value);
+    }
 }
 void mm_write_word(MemoryMap *mm, uint16_t addr, uint16_t value) {
     mm_write(mm, addr, value & 0xff);
@@ -5,22 +5,57 @@
 
 #define MASK_COLOR 0b111111
 
+#define MM_PAGE_SHIFT 8
+#define MM_PAGE_SIZE (1 << MM_PAGE_SHIFT)
+#define MASK_MM_PAGE (MM_PAGE_SIZE - 1)
+#define MM_PAGES (0x10000 >> MM_PAGE_SHIFT)
+
 // Forward declarations
 typedef struct Machine Machine;
 
 typedef uint8_t (*ReadFuncPtr)(Machine *, uint16_t);
 typedef void (*WriteFuncPtr)(Machine *, uint16_t, uint8_t);
 
+typedef struct MemoryPage {
+    uint8_t *data;      // Memory behind the page, NULL if only I/O
+    bool direct_read;   // Accessing data without any handler, when the
+    bool direct_write;  // page has nothing else mapped in that direction
+    ReadFuncPtr read;   // Handlers for the whole page...
+    WriteFuncPtr write;
+    ReadFuncPtr *reads; // ...unless it has one per address, or NULL
+    WriteFuncPtr *writes;
+} MemoryPage;
+
 typedef struct MemoryMap {
     Machine *vm;
     uint8_t last_read;
     uint16_t addr_mask;
-    ReadFuncPtr read[0x10000];
-    WriteFuncPtr write[0x10000];
+    ReadFuncPtr read_data; // Handlers accessing the data of a page, which
+    WriteFuncPtr write_data; // the direct accesses stand in for
+    MemoryPage pages[MM_PAGES];
 } MemoryMap;
 
 void memory_map_cpu_init(MemoryMap *mm, Machine *vm);
 void memory_map_ppu_init(MemoryMap *mm, Machine *vm);
+void memory_map_teardown(MemoryMap *mm);
+
+// Ranges are inclusive, and map every address in them to the same handler
+void mm_map_read(MemoryMap *mm, uint16_t first, uint16_t last,
+                 ReadFuncPtr func);
+void mm_map_write(MemoryMap *mm, uint16_t first, uint16_t last,
+                  WriteFuncPtr func);
+// Same with one handler per address, taken from funcs
+void mm_map_reads(MemoryMap *mm, uint16_t first, uint16_t last,
+                  const ReadFuncPtr *funcs);
+ReadFuncPtr mm_get_read(const MemoryMap *mm, uint16_t addr);
+WriteFuncPtr mm_get_write(const MemoryMap *mm, uint16_t addr);
+// Maps whole pages to memory repeated every size bytes, accessed directly
+// (unless handlers get mapped over it later on)
+void mm_map_memory(MemoryMap *mm, uint16_t first, uint16_t last,
+                   uint8_t *data, int size, bool is_writable);
+// Points pages already mapped to memory at other banks of it, in place
+void mm_set_banks(MemoryPage *pages, uint8_t *const *banks, int banks_len,
+                  int bank_size);
 
 uint8_t mm_read(MemoryMap *mm, uint16_t addr);
 uint16_t mm_read_word(MemoryMap *mm, uint16_t addr);
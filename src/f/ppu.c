@@ -51,14 +51,20 @@ static const uint32_t colors_ntsc[] = {
     0x80C0E0, 0x000000, 0x000000, 0x000000,
 };*/
 
-// Source: http://graphics.stanford.edu/~seander/bithacks.html#BitReverseTable
-static const uint8_t bit_reverse[] =
-{
-#   define R2(n)     n,     n + 2*64,     n + 1*64,     n + 3*64
-#   define R4(n) R2(n), R2(n + 2*16), R2(n + 1*16), R2(n + 3*16)
-#   define R6(n) R4(n), R4(n + 2*4 ), R4(n + 1*4 ), R4(n + 3*4 )
-    R6(0), R6(2), R6(1), R6(3)
-};
+// Spreads the bits of a pattern byte out to one per byte, from the leftmost
+// pixel in the lowest byte up, or from the rightmost one if flipped
+static inline uint64_t spread_pattern(uint8_t pt, bool flip) {
+    const uint64_t lanes = (flip ? 0x8040201008040201 : 0x0102040810204080);
+    const uint64_t bits = (pt * 0x0101010101010101 & lanes) +
+                          0x7F7F7F7F7F7F7F7F;
+    return (bits >> 7) & 0x0101010101010101;
+}
+
+// Both bit planes of a pattern row, decoded to one 2 bit pixel per byte
+static inline uint64_t decode_pattern_row(uint8_t pt0, uint8_t pt1,
+                                          bool flip) {
+    return spread_pattern(pt0, flip) | (spread_pattern(pt1, flip) << 1);
+}
 
 static inline void increment_mm_addr(PPU *ppu) {
     ppu->v += (ppu->ctrl & CTRL_ADDR_INC_32 ? 32 : 1);
@@ -68,66 +74,112 @@ static inline bool is_rendering(PPU *ppu) {
     return ppu->mask & (MASK_RENDER_BACKGROUND | MASK_RENDER_SPRITES);
 }
 
+// Flags of the sprite pixels from slot s, in the format of s_line
+static inline int get_sprite_pixel_flags(PPU *ppu, int s) {
+    const uint8_t attrs = ppu->s_attrs[s];
+    return ((attrs & 0b11) << 2) |
+           (attrs & OAM_ATTR_UNDER_BG ? SPRITE_PIXEL_UNDER_BG : 0) |
+           (ppu->s_has_zero && !s ? SPRITE_PIXEL_ZERO : 0);
+}
+
+static inline bool is_scanline_shown(int scanline) {
+    return scanline >= HEIGHT_CROPPED_BEGIN && scanline <= HEIGHT_CROPPED_END;
+}
+
+// Converts a finished scanline from palette indices to the screen format,
+// all at once since there is nothing else to it than a table lookup
+static void output_scanline(PPU *ppu, int scanline) {
+    if (!is_scanline_shown(scanline)) {
+        return;
+    }
+    void *screen = ppu->screens[ppu->current_screen];
+    const int first = (scanline - HEIGHT_CROPPED_BEGIN) * WIDTH;
+    switch (ppu->screen_format) {
+        case SF_ARGB8888:
+            for (int i = 0; i < WIDTH; i++) {
+                ((uint32_t *)screen)[first + i] = colors_ntsc[ppu->line[i]];
+            }
+            break;
+        case SF_RGB565:
+            for (int i = 0; i < WIDTH; i++) {
+                ((uint16_t *)screen)[first + i] =
+                    ppu->colors_rgb565[ppu->line[i]];
+            }
+            break;
+        case SF_INDEXED:
+            memcpy((uint8_t *)screen + first, ppu->line, WIDTH);
+            break;
+    }
+}
+
 // CYCLE TASKS //
 
-static void task_render_pixel(PPU *ppu, const RenderPos *pos) {
-    int s_index = 0;
-    uint8_t s_attrs = 0;
-    bool s_is_zero = false;
-    int bg_index = 0;
-    
-    if (ppu->mask & MASK_RENDER_SPRITES) {
-        // Decrement all sprites,
-        // while looking for a matching non-transparent pixel
-        for (int s = 0; s < 8; s++) {
-            if (ppu->s_x[s] > 0) {
-                ppu->s_x[s]--;
-            } else {
-                if (!s_index && (ppu->mask & MASK_NOCLIP_SPRITES ||
-                                 pos->cycle >= 8)) {
-                    s_index = ((ppu->s_pt0[s] & 128) >> 7) |
-                              ((ppu->s_pt1[s] & 128) >> 6);
-                    if (s_index) {
-                        s_attrs = ppu->s_attrs[s];
-                        s_is_zero = ppu->s_has_zero && !s;
-                    }
+// Sprite pixel in the same format as s_line, out of the first sprite with
+// one at the current cycle, while counting all of them down
+static inline int step_sprites(PPU *ppu, const RenderPos *pos) {
+    int spr = 0;
+    for (int s = 0; s < 8; s++) {
+        if (ppu->s_x[s] > 0) {
+            ppu->s_x[s]--;
+        } else {
+            if (!spr && (ppu->mask & MASK_NOCLIP_SPRITES || pos->cycle >= 8)) {
+                spr = ppu->s_rows[s] & 0b11;
+                if (spr) {
+                    spr |= get_sprite_pixel_flags(ppu, s);
                 }
-                ppu->s_pt0[s] <<= 1;
-                ppu->s_pt1[s] <<= 1;
             }
+            ppu->s_rows[s] >>= 8;
         }
     }
-    if (ppu->mask & MASK_RENDER_BACKGROUND) {
-        if (ppu->mask & MASK_NOCLIP_BACKGROUND || pos->cycle >= 8) {
-            bg_index = (((ppu->bg_pt0 << ppu->x) & 32768) >> 15) |
-                       (((ppu->bg_pt1 << ppu->x) & 32768) >> 14);
-        }
-    }
+    return spr;
+}
+
+// Draws the sprite pixel spr over the background one bg (its palette in
+// bits 2-3), either of them being 0 if transparent
+static inline void draw_pixel(PPU *ppu, const RenderPos *pos, int spr,
+                              int bg) {
+    const int s_index = spr & 0b11;
+    const int bg_index = bg & 0b11;
     
-    if (bg_index && s_index && s_is_zero) {
+    if (bg_index && s_index && spr & SPRITE_PIXEL_ZERO) {
         // TODO: delay by 1/2 (??) cycles
         ppu->status |= STATUS_SPRITE0_HIT;
     }
     
-    if (pos->scanline >= HEIGHT_CROPPED_BEGIN &&
-        pos->scanline <= HEIGHT_CROPPED_END) {
+    if (is_scanline_shown(pos->scanline)) {
         int color;
-        if (s_index && (!(s_attrs & OAM_ATTR_UNDER_BG) || !bg_index)) {
-            color = ppu->palettes[((s_attrs & 0b11) + 4) * 3 + s_index - 1];
+        if (s_index && (!(spr & SPRITE_PIXEL_UNDER_BG) || !bg_index)) {
+            color = ppu->palettes[(((spr >> 2) & 0b11) + 4) * 3 + s_index - 1];
         } else if (bg_index) {
-            int palette = (((ppu->bg_at0 << ppu->x) & 32768) >> 15) |
-                          (((ppu->bg_at1 << ppu->x) & 32768) >> 14);
-            color = ppu->palettes[palette * 3 + bg_index - 1];
+            color = ppu->palettes[(bg >> 2) * 3 + bg_index - 1];
         } else {
             color = ppu->background_colors[0];
         }
         
+        ppu->line[pos->cycle] = color;
         int pixel = (pos->scanline - HEIGHT_CROPPED_BEGIN) * WIDTH + pos->cycle;
-        ppu->screens[ppu->current_screen][pixel] = colors_ntsc[color];
         if (pixel == *ppu->lightgun_pos && (color == 0x20 || color == 0x30)) {
             ppu->lightgun_sensor = LIGHTGUN_COOLDOWN;
         }
     }
+}
+
+static void task_render_pixel(PPU *ppu, const RenderPos *pos) {
+    int bg = 0;
+    if (ppu->mask & MASK_RENDER_BACKGROUND) {
+        if (ppu->mask & MASK_NOCLIP_BACKGROUND || pos->cycle >= 8) {
+            bg = (((ppu->bg_pt0 << ppu->x) & 32768) >> 15) |
+                 (((ppu->bg_pt1 << ppu->x) & 32768) >> 14) |
+                 (((ppu->bg_at0 << ppu->x) & 32768) >> 13) |
+                 (((ppu->bg_at1 << ppu->x) & 32768) >> 12);
+        }
+    }
+    int spr = 0;
+    if (ppu->mask & MASK_RENDER_SPRITES) {
+        spr = step_sprites(ppu, pos);
+        ppu->s_line_ready = false;
+    }
+    draw_pixel(ppu, pos, spr, bg);
 
     ppu->bg_at0 <<= 1;
     ppu->bg_at1 <<= 1;
@@ -135,33 +187,29 @@ static void task_render_pixel(PPU *ppu, const RenderPos *pos) {
     ppu->bg_pt1 <<= 1;
 }
 
-static void task_sprite_clear(PPU *ppu, const RenderPos *pos) {
+// Goes through all of OAM at once, where the real PPU looks at a sprite
+// every 3 cycles from cycle 65, and notes the cycle at which the overflow
+// flag would be set (not accurate behaviour, but very rarely used)
+static void task_sprite_eval(PPU *ppu, const RenderPos *pos) {
     if (pos->scanline < 0) {
         return;
     }
     memset(ppu->oam2, 0xFF, sizeof(ppu->oam2));
     ppu->s_total = 0;
-}
-
-static void task_sprite_eval(PPU *ppu, const RenderPos *pos) {
-    if (pos->scanline < 0) {
-        return;
-    }
-    const uint8_t *spr = ppu->oam + ((pos->cycle - 65) / 3 * 4);
-    const int sprite_height = (ppu->ctrl & CTRL_8x16_SPRITES ? 16 : 8);
-    if (spr[OAM_Y] <= pos->scanline &&
-        (spr[OAM_Y] + sprite_height - 1) >= pos->scanline) {
-        if (ppu->s_total >= 8) {
-            // Not accurate behaviour, but very rarely used
-            ppu->status |= STATUS_SPRITE_OVERFLOW;
-        } else {
+    ppu->s_has_zero_next = false;
+    const unsigned sprite_height = (ppu->ctrl & CTRL_8x16_SPRITES ? 16 : 8);
+    for (int i = 0; i < 64; i++) {
+        const uint8_t *spr = ppu->oam + i * 4;
+        if ((unsigned)(pos->scanline - spr[OAM_Y]) < sprite_height) {
+            if (ppu->s_total == 8) {
+                ppu->s_overflow_cycle = 65 + i * 3;
+                break;
+            }
             memcpy(ppu->oam2 + (ppu->s_total * 4), spr, 4);
             ppu->s_total++;
+            ppu->s_has_zero_next |= !i;
         }
     }
-    if (spr == ppu->oam) {
-        ppu->s_has_zero_next = ppu->s_total;
-    }
 }
 
 static void task_fetch_nt(PPU *ppu, const RenderPos *pos) {
@@ -182,6 +230,17 @@ static uint8_t fetch_bg_pt(PPU *ppu, int offset) {
     return mm_read(ppu->mm, pt_addr);
 }
 
+// Palette of the tile being fetched, out of its attribute byte
+static int get_bg_palette(PPU *ppu) {
+    int offset;
+    if (((ppu->v >> 5) & 0b11) > 1) {
+        offset = ((ppu->v & 0b11) > 1 ? 6 : 4);
+    } else {
+        offset = ((ppu->v & 0b11) > 1 ? 2 : 0);
+    }
+    return (ppu->f_at >> offset) & 0b11;
+}
+
 static void task_fetch_bg_pt0(PPU *ppu, const RenderPos *pos) {
     ppu->f_pt0 = fetch_bg_pt(ppu, 0);
 }
@@ -200,13 +259,7 @@ static void task_fetch_bg_pt1(PPU *ppu, const RenderPos *pos) {
     ppu->bg_pt0 |= ppu->f_pt0;
     ppu->bg_pt1 |= ppu->f_pt1;
     
-    int offset;
-    if (((ppu->v >> 5) & 0b11) > 1) {
-        offset = ((ppu->v & 0b11) > 1 ? 6 : 4);
-    } else {
-        offset = ((ppu->v & 0b11) > 1 ? 2 : 0);
-    }
-    int at = (ppu->f_at >> offset) & 0b11;
+    const int at = get_bg_palette(ppu);
     if (at & 1) {
         ppu->bg_at0 |= 0xFF;
     }
@@ -236,29 +289,47 @@ static uint8_t fetch_spr_pt(PPU *ppu, int scanline, int i, int offset) {
     if (bank) {
         pt_addr |= (1 << 12);
     }
-    uint8_t p = mm_read(ppu->mm, pt_addr);
-    if (i >= ppu->s_total) {
-        p = 0;
-    } else if (spr[OAM_ATTRS] & OAM_ATTR_FLIP_H) {
-        p = bit_reverse[p];
+    return mm_read(ppu->mm, pt_addr);
+}
+
+// Lays out the pixels of all the sprites just fetched over the next
+// scanline, where step_sprites() would find them, the first ones on top
+static void composite_sprites(PPU *ppu) {
+    memset(ppu->s_line, 0, sizeof(ppu->s_line));
+    for (int s = 7; s >= 0; s--) {
+        const int flags = get_sprite_pixel_flags(ppu, s);
+        uint64_t row = ppu->s_rows[s];
+        for (int x = ppu->s_x[s]; row && x < WIDTH; x++, row >>= 8) {
+            if (row & 0b11) {
+                ppu->s_line[x] = (row & 0b11) | flags;
+            }
+        }
     }
-    return p;
+    ppu->s_line_ready = true;
 }
 
 static void task_fetch_spr_pt0(PPU *ppu, const RenderPos *pos) {
     int i = (pos->cycle - 261) / 8;
-    ppu->s_pt0[i] = fetch_spr_pt(ppu, pos->scanline, i, 0);
+    ppu->f_spr_pt0 = fetch_spr_pt(ppu, pos->scanline, i, 0);
     
     ppu->s_attrs[i] = ppu->oam2[i * 4 + OAM_ATTRS];
 }
 
 static void task_fetch_spr_pt1(PPU *ppu, const RenderPos *pos) {
     int i = (pos->cycle - 263) / 8;
-    ppu->s_pt1[i] = fetch_spr_pt(ppu, pos->scanline, i, 8);
+    const uint8_t pt1 = fetch_spr_pt(ppu, pos->scanline, i, 8);
+    ppu->s_rows[i] = (i < ppu->s_total ?
+                      decode_pattern_row(ppu->f_spr_pt0, pt1,
+                                         ppu->s_attrs[i] & OAM_ATTR_FLIP_H) :
+                      0);
     
     ppu->s_x[i] = ppu->oam2[i * 4 + OAM_X];
     
     ppu->s_has_zero = ppu->s_has_zero_next;
+    
+    if (i == 7) {
+        composite_sprites(ppu);
+    }
 }
 
 static void task_update_inc_hori_v(PPU *ppu, const RenderPos *pos) {
@@ -300,10 +371,223 @@ static void task_update_vert_v_vert_t(PPU *ppu,
     }
 }
 
+// Runs the tasks of a rendering scanline due on a cycle: sprite evaluation,
+// then fetches, then updates of v, all on fixed cycles that fall into
+// three stretches
+static void step_tasks(PPU *ppu, const RenderPos *pos) {
+    const int cycle = pos->cycle;
+    if (cycle == 65) {
+        task_sprite_eval(ppu, pos);
+    }
+    
+    // 257-320: Sprites for the next scanline
+    if (cycle > WIDTH && cycle <= 320) {
+        switch ((cycle - 257) & 7) {
+            case 0:
+                task_fetch_nt(ppu, pos);
+                break;
+            case 2:
+                task_fetch_at(ppu, pos);
+                break;
+            case 4:
+                task_fetch_spr_pt0(ppu, pos);
+                break;
+            case 6:
+                task_fetch_spr_pt1(ppu, pos);
+                break;
+        }
+        if (cycle == 257) {
+            task_update_hori_v_hori_t(ppu, pos);
+        } else if (cycle >= 280 && cycle <= 304) {
+            task_update_vert_v_vert_t(ppu, pos);
+        }
+        return;
+    }
+    
+    // 1-256: Background for this scanline, 321-340: for the next one
+    switch (cycle & 7) {
+        case 0:
+            if (cycle == WIDTH) {
+                task_update_inc_vert_v(ppu, pos);
+            } else if (cycle) {
+                task_update_inc_hori_v(ppu, pos);
+            }
+            break;
+        case 1:
+            task_fetch_nt(ppu, pos);
+            break;
+        case 3:
+            task_fetch_at(ppu, pos);
+            break;
+        case 5:
+            task_fetch_bg_pt0(ppu, pos);
+            break;
+        case 7:
+            task_fetch_bg_pt1(ppu, pos);
+            break;
+    }
+}
+
+// WHOLE SCANLINES //
+
+// Flags changing at the start of a scanline, and the lightgun sensor fading
+static void step_flags(PPU *ppu, const RenderPos *pos) {
+    if (!pos->cycle) {
+        ppu->s_overflow_cycle = 0;
+    }
+    if (pos->cycle == 1) {
+        switch (pos->scanline) {
+            case -1:
+                ppu->status &= ~(STATUS_VBLANK |
+                                 STATUS_SPRITE0_HIT | STATUS_SPRITE_OVERFLOW);
+                break;
+            case 241:
+                ppu->status |= STATUS_VBLANK;
+                if (ppu->ctrl & CTRL_NMI_ON_VBLANK) {
+                    ppu->cpu->nmi = true;
+                }
+                break;
+        }
+    }
+    
+    if (!pos->cycle && (ppu->lightgun_sensor > 0)) {
+        ppu->lightgun_sensor--;
+    }
+}
+
+static bool has_sprite_pixels(PPU *ppu) {
+    if (!(ppu->mask & MASK_RENDER_SPRITES)) {
+        return false;
+    }
+    for (int s = 0; s < 8; s++) {
+        if (ppu->s_rows[s]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static inline void store_pattern_row(uint8_t *pixels, uint64_t row) {
+    for (int i = 0; i < 8; i++) {
+        pixels[i] = (uint8_t)(row >> (i * 8));
+    }
+}
+
+// Runs the tasks of a visible scanline with the same outcome as ppu_step()
+// on every cycle, as far as anything outside of the PPU can tell: pixels
+// never touch memory, so all the background fetches can happen first (in
+// the same order), and sprite evaluation only reads OAM, which can't
+// change in the meantime
+static void render_scanline(PPU *ppu, int scanline) {
+    RenderPos pos = {scanline, 0};
+    if (!is_rendering(ppu)) {
+        for (; pos.cycle < WIDTH; pos.cycle++) {
+            task_render_pixel(ppu, &pos);
+            step_flags(ppu, &pos);
+        }
+        output_scanline(ppu, scanline);
+        return;
+    }
+
+    task_sprite_eval(ppu, &pos);
+    if (ppu->s_overflow_cycle) {
+        ppu->status |= STATUS_SPRITE_OVERFLOW;
+    }
+
+    // Background pixels in the order the shift registers would pass them
+    // along: the two tiles already in there, then the ones fetched on the
+    // way, which leave nothing behind in them by the end of the scanline
+    uint8_t bg[16 + 32 * 8];
+    for (int i = 0; i < 16; i++) {
+        const int bit = 15 - i;
+        bg[i] = ((ppu->bg_pt0 >> bit) & 1) |
+                (((ppu->bg_pt1 >> bit) & 1) << 1) |
+                (((ppu->bg_at0 >> bit) & 1) << 2) |
+                (((ppu->bg_at1 >> bit) & 1) << 3);
+    }
+    for (pos.cycle = 7; pos.cycle < WIDTH; pos.cycle += 8) {
+        task_fetch_nt(ppu, &pos);
+        task_fetch_at(ppu, &pos);
+        task_fetch_bg_pt0(ppu, &pos);
+        ppu->f_pt1 = fetch_bg_pt(ppu, 8);
+        const uint64_t palette = get_bg_palette(ppu) << 2;
+        store_pattern_row(bg + 16 + (pos.cycle & ~7),
+                          decode_pattern_row(ppu->f_pt0, ppu->f_pt1, false) |
+                          (palette * 0x0101010101010101));
+        if (pos.cycle < WIDTH - 1) {
+            task_update_inc_hori_v(ppu, &pos);
+        }
+    }
+
+    // Sprites come out of s_line unless some of them were already drawn
+    // cycle by cycle, and then those that are all transparent can't draw
+    // anything until the next fetches, whether they are still counting
+    // down or not
+    const bool from_line = ppu->s_line_ready;
+    const bool with_sprites = (from_line ?
+                               ppu->mask & MASK_RENDER_SPRITES :
+                               has_sprite_pixels(ppu));
+    const bool with_bg = ppu->mask & MASK_RENDER_BACKGROUND;
+    for (pos.cycle = 0; pos.cycle < WIDTH; pos.cycle++) {
+        int pixel_bg = 0;
+        if (with_bg && (ppu->mask & MASK_NOCLIP_BACKGROUND || pos.cycle >= 8)) {
+            pixel_bg = bg[pos.cycle + ppu->x];
+        }
+        int spr = 0;
+        if (with_sprites && !from_line) {
+            spr = step_sprites(ppu, &pos);
+        } else if (with_sprites &&
+                   (ppu->mask & MASK_NOCLIP_SPRITES || pos.cycle >= 8)) {
+            spr = ppu->s_line[pos.cycle];
+        }
+        draw_pixel(ppu, &pos, spr, pixel_bg);
+        if (!pos.cycle) {
+            step_flags(ppu, &pos);
+        }
+    }
+    output_scanline(ppu, scanline);
+    task_update_inc_vert_v(ppu, &pos);
+
+    // Sprites for the next scanline, between nametable fetches going nowhere
+    for (pos.cycle = 257; pos.cycle < 321; pos.cycle += 2) {
+        switch ((pos.cycle - 257) & 7) {
+            case 0:
+                task_fetch_nt(ppu, &pos);
+                if (pos.cycle == 257) {
+                    task_update_hori_v_hori_t(ppu, &pos);
+                }
+                break;
+            case 2:
+                task_fetch_at(ppu, &pos);
+                break;
+            case 4:
+                task_fetch_spr_pt0(ppu, &pos);
+                break;
+            case 6:
+                task_fetch_spr_pt1(ppu, &pos);
+                break;
+        }
+    }
+
+    // First two tiles of the next scanline, then two useless fetches
+    for (pos.cycle = 321; pos.cycle < 337; pos.cycle += 8) {
+        task_fetch_nt(ppu, &pos);
+        task_fetch_at(ppu, &pos);
+        task_fetch_bg_pt0(ppu, &pos);
+        task_fetch_bg_pt1(ppu, &pos);
+        task_update_inc_hori_v(ppu, &pos);
+    }
+    task_fetch_nt(ppu, &pos);
+    task_fetch_at(ppu, &pos);
+}
+
 // MEMORY I/O //
 
 static uint8_t read_register(Machine *vm, uint16_t addr) {
     PPU *ppu = &vm->ppu;
+    if (ppu->is_deferred) {
+        machine_sync_ppu(vm);
+    }
     switch (addr & 7) {
         case PPUSTATUS:
             ppu->reg_latch = (ppu->reg_latch & 0b11111) | ppu->status;
@@ -409,99 +693,91 @@ static void write_palettes(Machine *vm, uint16_t addr, uint8_t value) {
 
 // PUBLIC FUNCTIONS //
 
-void ppu_init(PPU *ppu, MemoryMap *mm, CPU65xx *cpu, int *lightgun_pos) {
+void ppu_init(PPU *ppu, MemoryMap *mm, CPU65xx *cpu, int *lightgun_pos,
+              ScreenFormat screen_format) {
     memset(ppu, 0, sizeof(PPU));
     ppu->mm = mm;
     ppu->cpu = cpu;
     ppu->lightgun_pos = lightgun_pos;
     
-    // Fill the tasks array
-    // sprite
-    ppu->tasks[1][TASK_SPRITE] = task_sprite_clear;
-    for (int i = 0; i < 64; i++) {
-        ppu->tasks[65 + i * 3][TASK_SPRITE] = task_sprite_eval;
-    }
-    // fetch
-    for (int i = 1; i < PPU_CYCLES_PER_SCANLINE; i += 8) {
-        ppu->tasks[i][TASK_FETCH] = task_fetch_nt;
-        ppu->tasks[i + 2][TASK_FETCH] = task_fetch_at;
-    }
-    for (int i = 5; i < PPU_CYCLES_PER_SCANLINE; i += 8) {
-        ppu->tasks[i][TASK_FETCH] = task_fetch_bg_pt0;
-        ppu->tasks[i + 2][TASK_FETCH] = task_fetch_bg_pt1;
-    }
-    for (int i = 0; i < 64; i += 8) {
-        ppu->tasks[261 + i][TASK_FETCH] = task_fetch_spr_pt0;
-        ppu->tasks[263 + i][TASK_FETCH] = task_fetch_spr_pt1;
+    // Screens only take as much memory as their format needs
+    const int bytes_per_pixel[] = {4, 2, 1};
+    ppu->screen_format = screen_format;
+    ppu->screen_size = WIDTH * HEIGHT_CROPPED * bytes_per_pixel[screen_format];
+    for (int i = 0; i < 2; i++) {
+        ppu->screens[i] = calloc(1, ppu->screen_size);
     }
-    // update
-    for (int i = 8; i < 256; i += 8) {
-        ppu->tasks[i][TASK_UPDATE] = task_update_inc_hori_v;
-    }
-    ppu->tasks[256][TASK_UPDATE] = task_update_inc_vert_v;
-    ppu->tasks[257][TASK_UPDATE] = task_update_hori_v_hori_t;
-    for (int i = 280; i < 305; i++) {
-        ppu->tasks[i][TASK_UPDATE] = task_update_vert_v_vert_t;
+    for (int i = 0; i < 64; i++) {
+        const uint32_t c = colors_ntsc[i];
+        ppu->colors_rgb565[i] = ((c >> 8) & 0xF800) | ((c >> 5) & 0x07E0) |
+                                ((c >> 3) & 0x001F);
     }
-    ppu->tasks[328][TASK_UPDATE] = task_update_inc_hori_v;
-    ppu->tasks[336][TASK_UPDATE] = task_update_inc_hori_v;
     
     // CPU 2000-3FFF: PPU registers (8, repeated)
     MemoryMap *cpu_mm = cpu->mm;
-    for (int i = 0x2000; i < 0x4000; i++) {
-        cpu_mm->read[i] = read_register;
-        cpu_mm->write[i] = write_register;
-    }
+    mm_map_read(cpu_mm, 0x2000, 0x3FFF, read_register);
+    mm_map_write(cpu_mm, 0x2000, 0x3FFF, write_register);
     // CPU 4014: OAM DMA register
-    cpu_mm->write[0x4014] = write_oam_dma;
+    mm_map_write(cpu_mm, 0x4014, 0x4014, write_oam_dma);
     
     // PPU 3F00-3FFF: Palettes
-    for (int i = 0x3F00; i < 0x4000; i++) {
-        mm->read[i] = read_palettes;
-        mm->write[i] = write_palettes;
-    }
+    mm_map_read(mm, 0x3F00, 0x3FFF, read_palettes);
+    mm_map_write(mm, 0x3F00, 0x3FFF, write_palettes);
     for (int i = 0x3F00; i < 0x4000; i += 4) {
-        mm->read[i] = read_background_colors;
-        mm->write[i] = write_background_colors;
+        mm_map_read(mm, i, i, read_background_colors);
+        mm_map_write(mm, i, i, write_background_colors);
     }
 }
 
-void ppu_step(PPU *ppu, const RenderPos *pos, bool verbose) {
-    if (verbose && !pos->cycle) {
-        printf("-- Scanline %d --\n", pos->scanline);
-    }
-    
+void ppu_teardown(PPU *ppu) {
+    free(ppu->screens[0]);
+    free(ppu->screens[1]);
+}
+
+void ppu_step(PPU *ppu, const RenderPos *pos) {
     if (pos->scanline >= 0 && pos->scanline < HEIGHT_REAL &&
         pos->cycle < WIDTH) {
         task_render_pixel(ppu, pos);
+        if (pos->cycle == WIDTH - 1) {
+            output_scanline(ppu, pos->scanline);
+        }
     }
     
-    // Execute all tasks for that cycle
     if (pos->scanline < 240 && is_rendering(ppu)) {
-        for (int i = 0; i < 3; i++) {
-            if (ppu->tasks[pos->cycle][i]) {
-                (*ppu->tasks[pos->cycle][i])(ppu, pos);
-            }
+        step_tasks(ppu, pos);
+        if (ppu->s_overflow_cycle && pos->cycle == ppu->s_overflow_cycle) {
+            ppu->status |= STATUS_SPRITE_OVERFLOW;
         }
     }
     
-    // Check for flag operations
-    if (pos->cycle == 1) {
-        switch (pos->scanline) {
-            case -1:
-                ppu->status &= ~(STATUS_VBLANK |
-                                 STATUS_SPRITE0_HIT | STATUS_SPRITE_OVERFLOW);
-                break;
-            case 241:
-                ppu->status |= STATUS_VBLANK;
-                if (ppu->ctrl & CTRL_NMI_ON_VBLANK) {
-                    ppu->cpu->nmi = true;
-                }
-                break;
+    step_flags(ppu, pos);
+}
+
+void ppu_step_scanline(PPU *ppu, int scanline) {
+    RenderPos pos = {scanline, 0};
+    if (scanline >= 0 && scanline < HEIGHT_REAL) {
+        render_scanline(ppu, scanline);
+    } else if (scanline >= HEIGHT_REAL) {
+        // Nothing gets rendered or fetched, only flags change
+        for (; pos.cycle <= 1; pos.cycle++) {
+            step_flags(ppu, &pos);
+        }
+    } else {
+        for (; pos.cycle < PPU_CYCLES_PER_SCANLINE; pos.cycle++) {
+            ppu_step(ppu, &pos);
         }
     }
-    
-    if (!pos->cycle && (ppu->lightgun_sensor > 0)) {
-        ppu->lightgun_sensor--;
-    }
+}
+
+bool ppu_is_status_stable(PPU *ppu, const RenderPos *pos) {
+    // Reading VBlank would clear it, and all flags get cleared at the start
+    // of the pre-render line
+    if (ppu->status & STATUS_VBLANK || (pos->scanline < 0 && pos->cycle <= 1)) {
+        return false;
+    }
+    // Otherwise, until the start of VBlank or the end of the frame, the
+    // sprite flags are the only thing that could change
+    const uint8_t sprite_flags = STATUS_SPRITE0_HIT | STATUS_SPRITE_OVERFLOW;
+    return pos->scanline >= HEIGHT_REAL || !is_rendering(ppu) ||
+           (ppu->status & sprite_flags) == sprite_flags;
 }
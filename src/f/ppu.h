@@ -3,6 +3,8 @@
 
 #include "../common.h"
 
+#include "../driver.h"
+
 // Bit fields
 #define CTRL_SCROLL_PAGE_X 1
 #define CTRL_SCROLL_PAGE_Y (1 << 1)
@@ -29,6 +31,10 @@
 #define OAM_ATTR_UNDER_BG (1 << 5)
 #define OAM_ATTR_FLIP_H (1 << 6)
 #define OAM_ATTR_FLIP_V (1 << 7)
+// SPRITE_PIXEL 0-1: Pixel, 0 if transparent
+// SPRITE_PIXEL 2-3: Palette
+#define SPRITE_PIXEL_UNDER_BG (1 << 4)
+#define SPRITE_PIXEL_ZERO (1 << 5)
 
 // OAM property offsets
 #define OAM_Y 0
@@ -46,11 +52,6 @@
 #define PPUADDR 6
 #define PPUDATA 7
 
-// Tasks array
-#define TASK_SPRITE 0
-#define TASK_FETCH 1
-#define TASK_UPDATE 2
-
 // Screen dimensions
 #define WIDTH 256
 #define HEIGHT_REAL 240
@@ -73,8 +74,6 @@ typedef struct RenderPos {
     int cycle;
 } RenderPos;
 
-typedef void (*TaskFunc)(PPU *, const RenderPos *);
-
 struct PPU {
     CPU65xx *cpu;
     MemoryMap *mm;
@@ -104,27 +103,51 @@ struct PPU {
     uint8_t ppudata_latch;
     
     // Rendering pipeline
-    TaskFunc tasks[PPU_CYCLES_PER_SCANLINE][3];
     uint16_t f_nt, f_pt0, f_pt1;
     uint8_t f_at;
     uint16_t bg_pt0, bg_pt1;
     uint16_t bg_at0, bg_at1;
-    uint8_t s_pt0[8], s_pt1[8];
+    uint8_t f_spr_pt0;
+    uint64_t s_rows[8]; // Pixels left to draw, decoded one per byte
     uint8_t s_attrs[8];
     uint8_t s_x[8];
+    // The same, laid out over the next scanline when they get fetched,
+    // until drawing some of them cycle by cycle gets ahead of it
+    uint8_t s_line[WIDTH];
+    bool s_line_ready;
     int s_total;
+    int s_overflow_cycle; // When it gets flagged on this scanline, or 0
     bool s_has_zero, s_has_zero_next;
     
-    // Raw screen data, in ARGB8888 format
-    uint32_t screens[2][WIDTH * HEIGHT_CROPPED];
+    // Palette indices of the scanline being drawn
+    uint8_t line[WIDTH];
+    
+    // Raw screen data, in the format picked by the driver
+    ScreenFormat screen_format;
+    void *screens[2];
+    size_t screen_size;
+    uint16_t colors_rgb565[64];
     bool current_screen;
     
     // Lightgun sensor handling
     int *lightgun_pos;
     int lightgun_sensor;
+    
+    // Scanline left to render all at once at its end, unless the CPU does
+    // something that could change it first (see machine_sync_ppu())
+    bool is_deferred;
+    int deferred_scanline;
+    uint64_t deferred_mclk; // Master clock at its first cycle
 };
 
-void ppu_init(PPU *ppu, MemoryMap *mm, CPU65xx *cpu, int *lightgun_pos);
-void ppu_step(PPU *ppu, const RenderPos *pos, bool verbose);
+void ppu_init(PPU *ppu, MemoryMap *mm, CPU65xx *cpu, int *lightgun_pos,
+              ScreenFormat screen_format);
+void ppu_teardown(PPU *ppu);
+void ppu_step(PPU *ppu, const RenderPos *pos);
+// Same as ppu_step() on every cycle of a scanline, much faster when nothing
+// else has to run in between
+void ppu_step_scanline(PPU *ppu, int scanline);
+
+bool ppu_is_status_stable(PPU *ppu, const RenderPos *pos);
 
 #endif /* f_ppu_h */
@@ -0,0 +1,254 @@
+#include "profiler.h"
+
+#include <inttypes.h>
+
+#include "../debug_map.h"
+
+#define SIZE_LOCATIONS_RAM 0x8000
+
+// LOCATIONS //
+
+static uint32_t get_location(Profiler *prof, uint16_t addr) {
+    if (addr < SIZE_LOCATIONS_RAM) {
+        return addr;
+    }
+    const Cartridge *cart = &prof->vm->cart;
+    const uint8_t *bank = cart->prg_banks[(addr >> 13) & (PRG_BANKS - 1)];
+    return SIZE_LOCATIONS_RAM + (uint32_t)(bank - cart->prg_rom.data) +
+           (addr & MASK_PRG_BANK);
+}
+
+static void print_location(Profiler *prof, FILE *f, uint32_t loc,
+                           uint16_t addr) {
+    if (loc < SIZE_LOCATIONS_RAM) {
+        fprintf(f, "$%04X (RAM)    ", addr);
+    } else {
+        fprintf(f, "$%04X (bank %02X)",
+                addr, (loc - SIZE_LOCATIONS_RAM) / SIZE_PRG_BANK);
+    }
+}
+
+// LABELS //
+
+// Closest label at or before addr, if any
+static const DebugLabel *find_label(Profiler *prof, uint16_t addr) {
+    const DebugMap *map = prof->vm->dbg_map;
+    return (map ? debug_map_find(map, addr) : NULL);
+}
+
+static void print_function(Profiler *prof, FILE *f, uint32_t loc,
+                           uint16_t addr) {
+    const DebugLabel *label = find_label(prof, addr);
+    if (label) {
+        fprintf(f, "%s", label->name);
+    } else {
+        fprintf(f, "$%04X", addr);
+    }
+    // Only worth telling apart when banks can be switched
+    if (loc >= SIZE_LOCATIONS_RAM &&
+        prof->vm->cart.prg_rom.size > SIZE_PRG_ROM) {
+        fprintf(f, "@%02X", (loc - SIZE_LOCATIONS_RAM) / SIZE_PRG_BANK);
+    }
+}
+
+// CALL TREE //
+
+static int add_node(Profiler *prof, int parent, uint32_t entry,
+                    uint16_t entry_addr) {
+    if (prof->nodes_len == prof->nodes_cap) {
+        prof->nodes_cap *= 2;
+        prof->nodes = realloc(prof->nodes,
+                              sizeof(ProfilerNode) * prof->nodes_cap);
+    }
+    int i = prof->nodes_len++;
+    prof->nodes[i] = (ProfilerNode){parent, -1, -1, entry, entry_addr, 0};
+    if (parent >= 0) {
+        prof->nodes[i].next_sibling = prof->nodes[parent].first_child;
+        prof->nodes[parent].first_child = i;
+    }
+    return i;
+}
+
+static void push_frame(Profiler *prof, uint16_t entry_addr, uint8_t s) {
+    if (prof->depth == PROFILER_STACK_SIZE) {
+        return;
+    }
+    const uint32_t entry = get_location(prof, entry_addr);
+    const int parent = prof->stack[prof->depth - 1].node;
+    int node = prof->nodes[parent].first_child;
+    while (node >= 0 && prof->nodes[node].entry != entry) {
+        node = prof->nodes[node].next_sibling;
+    }
+    if (node < 0) {
+        node = add_node(prof, parent, entry, entry_addr);
+    }
+    prof->stack[prof->depth++] = (ProfilerFrame){node, s};
+}
+
+// REPORT //
+
+typedef struct FunctionTotal {
+    const DebugLabel *label;
+    uint32_t loc; // First location seen, for display
+    uint16_t addr;
+    int bank;
+    uint64_t insts;
+    uint64_t cycles;
+} FunctionTotal;
+
+static int compare_function_totals(const void *a, const void *b) {
+    const uint64_t ca = ((const FunctionTotal *)a)->cycles;
+    const uint64_t cb = ((const FunctionTotal *)b)->cycles;
+    return (ca < cb) - (ca > cb);
+}
+
+static int compare_counters(const void *a, const void *b) {
+    const uint64_t ca = (*(ProfilerCounter *const *)a)->cycles;
+    const uint64_t cb = (*(ProfilerCounter *const *)b)->cycles;
+    return (ca < cb) - (ca > cb);
+}
+
+static void print_path(Profiler *prof, FILE *f, int node) {
+    if (prof->nodes[node].parent >= 0) {
+        print_path(prof, f, prof->nodes[node].parent);
+        fprintf(f, ";");
+    }
+    print_function(prof, f, prof->nodes[node].entry,
+                   prof->nodes[node].entry_addr);
+}
+
+// PUBLIC FUNCTIONS //
+
+void profiler_init(Profiler *prof, Machine *vm) {
+    memset(prof, 0, sizeof(Profiler));
+    prof->vm = vm;
+
+    prof->counters_len = SIZE_LOCATIONS_RAM + (int)vm->cart.prg_rom.size;
+    prof->counters = calloc(prof->counters_len, sizeof(ProfilerCounter));
+
+    // Root of the call tree is wherever the CPU currently is
+    prof->nodes_cap = 256;
+    prof->nodes = malloc(sizeof(ProfilerNode) * prof->nodes_cap);
+    const uint16_t pc = vm->cpu.pc;
+    prof->stack[0] = (ProfilerFrame){add_node(prof, -1,
+                                              get_location(prof, pc), pc),
+                                     vm->cpu.s};
+    prof->depth = 1;
+}
+
+void profiler_teardown(Profiler *prof) {
+    free(prof->counters);
+    free(prof->nodes);
+}
+
+int profiler_step(Profiler *prof) {
+    Machine *vm = prof->vm;
+    CPU65xx *cpu = &vm->cpu;
+    const uint16_t pc = cpu->pc;
+    const uint8_t inst = machine_peek(vm, pc);
+    const bool is_interrupt = cpu->nmi ||
+                              (cpu->irq && !(cpu_65xx_get_p(cpu) & P_I));
+    const uint32_t loc = get_location(prof, pc);
+
+    const int t = cpu_65xx_step(cpu);
+
+    // Interrupt sequences are charged to the instruction they landed on
+    ProfilerCounter *counter = &prof->counters[loc];
+    counter->insts += !is_interrupt;
+    counter->cycles += t;
+    counter->addr = pc;
+    prof->nodes[prof->stack[prof->depth - 1].node].cycles += t;
+
+    // Leave the functions the stack has been unwound from (RTS, RTI or any
+    // other manipulation), then enter the new one if this was a call
+    while (prof->depth > 1 && cpu->s > prof->stack[prof->depth - 1].s) {
+        prof->depth--;
+    }
+    if (is_interrupt || inst == 0x20 || inst == 0x00) { // JSR, BRK
+        push_frame(prof, cpu->pc, cpu->s);
+    }
+
+    return t;
+}
+
+void profiler_write_report(Profiler *prof, FILE *f) {
+    // Group locations by function, which is the closest label before them,
+    // with everything before the first label lumped together per bank
+    FunctionTotal *totals = calloc(prof->counters_len, sizeof(FunctionTotal));
+    int totals_len = 0;
+    uint64_t total_cycles = 0;
+    ProfilerCounter **hot = malloc(sizeof(ProfilerCounter *) *
+                                   prof->counters_len);
+    int hot_len = 0;
+    for (int loc = 0; loc < prof->counters_len; loc++) {
+        const ProfilerCounter *counter = &prof->counters[loc];
+        if (!counter->insts && !counter->cycles) {
+            continue;
+        }
+        hot[hot_len++] = &prof->counters[loc];
+        total_cycles += counter->cycles;
+        const DebugLabel *label = find_label(prof, counter->addr);
+        const int bank = (loc < SIZE_LOCATIONS_RAM ? -1 :
+                          (loc - SIZE_LOCATIONS_RAM) / SIZE_PRG_BANK);
+        FunctionTotal *total = NULL;
+        for (int i = totals_len - 1; i >= 0; i--) {
+            if (totals[i].label == label && totals[i].bank == bank) {
+                total = &totals[i];
+                break;
+            }
+        }
+        if (!total) {
+            total = &totals[totals_len++];
+            *total = (FunctionTotal){label, loc,
+                                     label ? label->addr : counter->addr,
+                                     bank, 0, 0};
+        }
+        total->insts += counter->insts;
+        total->cycles += counter->cycles;
+    }
+    qsort(totals, totals_len, sizeof(FunctionTotal), compare_function_totals);
+    qsort(hot, hot_len, sizeof(ProfilerCounter *), compare_counters);
+
+    fprintf(f, "Total: %" PRIu64 " CPU cycles\n\n", total_cycles);
+    fprintf(f, "%14s %6s %12s  %-16s %s\n",
+            "Cycles", "%", "Insts", "Location", "Function");
+    for (int i = 0; i < totals_len; i++) {
+        const FunctionTotal *total = &totals[i];
+        fprintf(f, "%14" PRIu64 " %6.2f %12" PRIu64 "  ", total->cycles,
+                100.0 * total->cycles / total_cycles, total->insts);
+        print_location(prof, f, total->loc, total->addr);
+        if (total->label) {
+            fprintf(f, "  ");
+            print_function(prof, f, total->loc, total->addr);
+            fprintf(f, "\n");
+        } else {
+            fprintf(f, "  (unlabeled)\n");
+        }
+    }
+
+    fprintf(f, "\nHottest instructions:\n");
+    for (int i = 0; i < hot_len && i < 100; i++) {
+        const ProfilerCounter *counter = hot[i];
+        const uint32_t loc = (uint32_t)(counter - prof->counters);
+        fprintf(f, "%14" PRIu64 " %6.2f %12" PRIu64 "  ", counter->cycles,
+                100.0 * counter->cycles / total_cycles, counter->insts);
+        print_location(prof, f, loc, counter->addr);
+        fprintf(f, "  ");
+        print_function(prof, f, loc, counter->addr);
+        fprintf(f, "\n");
+    }
+
+    free(hot);
+    free(totals);
+}
+
+void profiler_write_collapsed(Profiler *prof, FILE *f) {
+    // One line per call path, as expected by flamegraph.pl and the like
+    for (int i = 0; i < prof->nodes_len; i++) {
+        if (!prof->nodes[i].cycles) {
+            continue;
+        }
+        print_path(prof, f, i);
+        fprintf(f, " %" PRIu64 "\n", prof->nodes[i].cycles);
+    }
+}
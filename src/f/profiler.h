@@ -0,0 +1,55 @@
+#ifndef f_profiler_h
+#define f_profiler_h
+
+#include "../common.h"
+
+#include "machine.h"
+
+#define PROFILER_STACK_SIZE 64
+
+// Executed instructions and CPU cycles at one location
+typedef struct ProfilerCounter {
+    uint64_t insts;
+    uint64_t cycles;
+    uint16_t addr; // CPU address it was last executed from
+} ProfilerCounter;
+
+// Call tree node, for each distinct path of function entry points
+typedef struct ProfilerNode {
+    int parent;
+    int first_child;
+    int next_sibling;
+    uint32_t entry; // Location of the function entry point
+    uint16_t entry_addr;
+    uint64_t cycles;
+} ProfilerNode;
+
+typedef struct ProfilerFrame {
+    int node;
+    uint8_t s; // Stack register right after the call
+} ProfilerFrame;
+
+typedef struct Profiler {
+    Machine *vm; // Functions are named after the labels of its dbg_map
+
+    // Locations are CPU addresses below 8000, and 8000 + the PRG ROM offset
+    // above, so that every bank gets counted separately
+    ProfilerCounter *counters;
+    int counters_len;
+
+    ProfilerNode *nodes;
+    int nodes_len;
+    int nodes_cap;
+    ProfilerFrame stack[PROFILER_STACK_SIZE];
+    int depth;
+} Profiler;
+
+void profiler_init(Profiler *prof, Machine *vm);
+void profiler_teardown(Profiler *prof);
+
+int profiler_step(Profiler *prof);
+
+void profiler_write_report(Profiler *prof, FILE *f);
+void profiler_write_collapsed(Profiler *prof, FILE *f);
+
+#endif /* f_profiler_h */
@@ -0,0 +1,100 @@
+#include "romdb.h"
+
+typedef struct RomNeedInfo {
+    RomNeed need;
+    const char *name;
+} RomNeedInfo;
+
+static const RomNeedInfo need_infos[] = {
+    {RN_MIDLINE, "midline"},
+    {RN_SPRITE0, "sprite0"},
+    {RN_DMC, "dmc"},
+};
+
+static FILE *open_database(void) {
+    const char *path = getenv("ROMDB");
+    if (path) {
+        return fopen(path, "r");
+    }
+    const char *xdg = getenv("XDG_CONFIG_HOME");
+    const char *home = getenv("HOME");
+    char db_path[1024];
+    if (xdg && *xdg) {
+        snprintf(db_path, sizeof(db_path), "%s/%s/%s",
+                 xdg, APP_NAME, ROMDB_FILE);
+    } else if (home && *home) {
+        snprintf(db_path, sizeof(db_path), "%s/.config/%s/%s",
+                 home, APP_NAME, ROMDB_FILE);
+    } else {
+        return NULL;
+    }
+    return fopen(db_path, "r");
+}
+
+// One game per line: the CRC32 in hex followed by what it needs among
+// need_infos (or "none"), anything after a # being a comment
+static bool parse_entry(char *line, uint32_t *crc, uint8_t *needs) {
+    char *comment = strchr(line, '#');
+    if (comment) {
+        *comment = 0;
+    }
+    char *word = strtok(line, " \t\r\n");
+    char *end;
+    if (!word || (*crc = strtoul(word, &end, 16), *end)) {
+        return false;
+    }
+    *needs = 0;
+    while ((word = strtok(NULL, " \t\r\n,"))) {
+        bool is_known = !strcmp(word, "none");
+        for (size_t i = 0; i < sizeof(need_infos) / sizeof(RomNeedInfo); i++) {
+            if (!strcmp(word, need_infos[i].name)) {
+                *needs |= need_infos[i].need;
+                is_known = true;
+            }
+        }
+        if (!is_known) {
+            eprintf("%s: Unknown need for %08X in ROM database\n",
+                    word, *crc);
+        }
+    }
+    return true;
+}
+
+// PUBLIC FUNCTIONS //
+
+bool romdb_lookup(uint32_t crc, uint8_t *needs) {
+    FILE *db_file = open_database();
+    if (!db_file) {
+        return false;
+    }
+    bool found = false;
+    char line[256];
+    while (!found && fgets(line, sizeof(line), db_file)) {
+        uint32_t entry_crc;
+        found = parse_entry(line, &entry_crc, needs) && entry_crc == crc;
+    }
+    fclose(db_file);
+    return found;
+}
+
+uint8_t romdb_guess(Machine *vm) {
+    // Raster effects are what mapper IRQs are for
+    uint8_t needs = (vm->cart.mapper_irq_enabled ? RN_MIDLINE : 0);
+    const blob *prg = &vm->cart.prg_rom;
+    for (size_t i = 0; i + 5 <= prg->size; i++) {
+        const uint8_t *code = prg->data + i;
+        // Polling for the sprite 0 hit: BIT $2002 then BVC/BVS, or
+        // LDA $2002 then AND #$40
+        if (code[1] == 0x02 && code[2] == 0x20 &&
+            ((code[0] == 0x2C && (code[3] == 0x50 || code[3] == 0x70)) ||
+             (code[0] == 0xAD && code[3] == 0x29 && code[4] == 0x40))) {
+            needs |= RN_SPRITE0;
+        }
+        // Setting up a DMC sample: STA/STX/STY $4012
+        if ((code[0] == 0x8D || code[0] == 0x8E || code[0] == 0x8C) &&
+            code[1] == 0x12 && code[2] == 0x40) {
+            needs |= RN_DMC;
+        }
+    }
+    return needs;
+}
@@ -0,0 +1,26 @@
+#ifndef f_romdb_h
+#define f_romdb_h
+
+#include "../common.h"
+
+#include "machine.h"
+
+#define ROMDB_FILE "romdb.txt"
+
+// What a game relies on that only the accurate tier emulates
+typedef enum {
+    RN_MIDLINE = 1 << 0, // PPU changes in the middle of scanlines
+    RN_SPRITE0 = 1 << 1, // Exact timing of the sprite 0 hit
+    RN_DMC     = 1 << 2, // DMC cycle stealing
+} RomNeed;
+
+// Looks up the ROM database by the CRC32 of PRG and CHR ROM combined, in
+// $XDG_CONFIG_HOME/f-type/romdb.txt (or ~/.config/f-type), or in the file
+// from the ROMDB environment variable
+bool romdb_lookup(uint32_t crc, uint8_t *needs);
+
+// Best guess for games missing from the database, from the mapper and from
+// code patterns found in PRG ROM
+uint8_t romdb_guess(Machine *vm);
+
+#endif /* f_romdb_h */
@@ -0,0 +1,118 @@
+#include "trace.h"
+
+// WRITER THREAD //
+
+static void *thread_writer(Trace *trace) {
+    pthread_mutex_lock(&trace->lock);
+    while (true) {
+        while (trace->tail == trace->published && !trace->closing) {
+            pthread_cond_wait(&trace->cond, &trace->lock);
+        }
+        const uint64_t published = trace->published;
+        if (trace->tail == published) {
+            break;
+        }
+        pthread_mutex_unlock(&trace->lock);
+
+        // Save everything published so far, in up to two parts as it wraps
+        // around the end of the buffer
+        uint64_t tail = trace->tail;
+        while (tail < published) {
+            const size_t i = tail % TRACE_BUFFER_RECORDS;
+            size_t n = published - tail;
+            if (n > TRACE_BUFFER_RECORDS - i) {
+                n = TRACE_BUFFER_RECORDS - i;
+            }
+            fwrite(trace->buffer + i, sizeof(TraceRecord), n, trace->file);
+            tail += n;
+        }
+
+        pthread_mutex_lock(&trace->lock);
+        trace->tail = tail;
+        pthread_cond_signal(&trace->cond);
+    }
+    pthread_mutex_unlock(&trace->lock);
+    return NULL;
+}
+
+static void publish(Trace *trace) {
+    pthread_mutex_lock(&trace->lock);
+    trace->published = trace->head;
+    pthread_cond_signal(&trace->cond);
+    // Make sure the next chunk has room, stalling the emulation if the
+    // writer can't keep up rather than losing records
+    while (trace->head + TRACE_CHUNK_RECORDS - trace->tail >
+           TRACE_BUFFER_RECORDS) {
+        pthread_cond_wait(&trace->cond, &trace->lock);
+    }
+    pthread_mutex_unlock(&trace->lock);
+}
+
+// PUBLIC FUNCTIONS //
+
+bool trace_init(Trace *trace, const char *path) {
+    memset(trace, 0, sizeof(Trace));
+    trace->file = fopen(path, "wb");
+    if (!trace->file) {
+        return false;
+    }
+    TraceHeader header = {
+        .version = TRACE_VERSION,
+        .record_size = sizeof(TraceRecord),
+    };
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    fwrite(&header, sizeof(TraceHeader), 1, trace->file);
+
+    trace->buffer = malloc(sizeof(TraceRecord) * TRACE_BUFFER_RECORDS);
+    pthread_mutex_init(&trace->lock, NULL);
+    pthread_cond_init(&trace->cond, NULL);
+    if (pthread_create(&trace->thread, NULL,
+                       (void *(*)(void *))thread_writer, trace)) {
+        pthread_cond_destroy(&trace->cond);
+        pthread_mutex_destroy(&trace->lock);
+        free(trace->buffer);
+        fclose(trace->file);
+        return false;
+    }
+    return true;
+}
+
+void trace_teardown(Trace *trace) {
+    publish(trace);
+    pthread_mutex_lock(&trace->lock);
+    trace->closing = true;
+    pthread_cond_signal(&trace->cond);
+    pthread_mutex_unlock(&trace->lock);
+    pthread_join(trace->thread, NULL);
+
+    pthread_cond_destroy(&trace->cond);
+    pthread_mutex_destroy(&trace->lock);
+    free(trace->buffer);
+    fclose(trace->file);
+}
+
+int trace_step(Trace *trace, Machine *vm, const RenderPos *pos) {
+    CPU65xx *cpu = &vm->cpu;
+    TraceRecord *r = &trace->buffer[trace->head % TRACE_BUFFER_RECORDS];
+    const uint8_t p = cpu_65xx_get_p(cpu);
+    r->mclk = vm->mclk;
+    r->pc = cpu->pc;
+    r->operand = machine_peek(vm, cpu->pc + 1) |
+                 machine_peek(vm, cpu->pc + 2) << 8;
+    r->scanline = pos->scanline;
+    r->cycle = pos->cycle;
+    r->type = (cpu->nmi ? TR_NMI :
+               (cpu->irq && !(p & P_I) ? TR_IRQ : TR_INSTRUCTION));
+    r->inst = machine_peek(vm, cpu->pc);
+    r->a = cpu->a;
+    r->x = cpu->x;
+    r->y = cpu->y;
+    r->p = p;
+    r->s = cpu->s;
+    r->padding = 0;
+    if (!(++trace->head % TRACE_CHUNK_RECORDS)) {
+        publish(trace);
+    }
+
+    return cpu_65xx_step(cpu);
+}
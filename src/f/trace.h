@@ -0,0 +1,64 @@
+#ifndef f_trace_h
+#define f_trace_h
+
+#include "../common.h"
+#include <pthread.h>
+
+#include "machine.h"
+
+#define TRACE_MAGIC "FTRC"
+#define TRACE_VERSION 1
+
+// Records are handed to the writer thread a chunk at a time
+#define TRACE_BUFFER_RECORDS (1 << 16)
+#define TRACE_CHUNK_RECORDS (1 << 12)
+
+typedef enum {
+    TR_INSTRUCTION,
+    TR_NMI,
+    TR_IRQ,
+} TraceRecordType;
+
+// CPU state right before an instruction (or interrupt sequence) runs
+typedef struct TraceRecord {
+    uint64_t mclk;
+    uint16_t pc;
+    uint16_t operand; // The two bytes following the opcode
+    int16_t scanline;
+    uint16_t cycle;
+    uint8_t type;
+    uint8_t inst;
+    uint8_t a;
+    uint8_t x;
+    uint8_t y;
+    uint8_t p;
+    uint8_t s;
+    uint8_t padding;
+} TraceRecord;
+
+typedef struct TraceHeader {
+    char magic[4];
+    uint16_t version;
+    uint16_t record_size;
+} TraceHeader;
+
+// Ring buffer filled by the emulation thread, and drained to the file by
+// a writer thread of its own
+typedef struct Trace {
+    FILE *file;
+    TraceRecord *buffer;
+    uint64_t head;      // Records written, only used by the emulation thread
+    uint64_t published; // Records made available to the writer thread
+    uint64_t tail;      // Records saved to the file
+    bool closing;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} Trace;
+
+bool trace_init(Trace *trace, const char *path);
+void trace_teardown(Trace *trace);
+
+int trace_step(Trace *trace, Machine *vm, const RenderPos *pos);
+
+#endif /* f_trace_h */
@@ -0,0 +1,29 @@
+#include "file.h"
+
+bool load_file(const char *path, blob *out) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        eprintf("%s: Error opening file\n", path);
+        return false;
+    }
+    if (fseeko(f, 0, SEEK_END)) {
+        eprintf("%s: Error determining file size\n", path);
+        fclose(f);
+        return false;
+    }
+    out->size = ftello(f);
+    if (fseeko(f, 0, SEEK_SET)) {
+        eprintf("%s: Error seeking file\n", path);
+        fclose(f);
+        return false;
+    }
+    out->data = malloc(out->size);
+    if (out->size && fread(out->data, out->size, 1, f) < 1) {
+        eprintf("%s: Error reading file\n", path);
+        free(out->data);
+        fclose(f);
+        return false;
+    }
+    fclose(f);
+    return true;
+}
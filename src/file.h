@@ -0,0 +1,9 @@
+#ifndef file_h
+#define file_h
+
+#include "common.h"
+
+// Loads the entire file in memory, printing what went wrong if it can't
+bool load_file(const char *path, blob *out);
+
+#endif
@@ -1,6 +1,8 @@
 #include "common.h"
 #include <libgen.h>
 
+#include "debug_map.h"
+#include "file.h"
 #include "f/loader.h"
 #include "s/loader.h"
 #include "driver.h"
@@ -14,36 +16,30 @@ int main(int argc, char *argv[]) {
     }
     
     // Load the entire file in memory
-    FILE *rom_file = fopen(argv[1], "rb");
-    if (!rom_file) {
-        eprintf("%s: Error opening file\n", argv[1]);
-        return 1;
-    }
-    if (fseeko(rom_file, 0, SEEK_END)) {
-        eprintf("%s: Error determining file size\n", argv[1]);
+    blob rom;
+    if (!load_file(argv[1], &rom)) {
         return 1;
     }
-    blob rom;
-    rom.size = ftello(rom_file);
     if (rom.size < 1024) {
         eprintf("%s: File is too small\n", argv[1]);
         return 1;
     }
-    if (fseeko(rom_file, 0, SEEK_SET)) {
-        eprintf("%s: Error seeking file\n", argv[1]);
-        return 1;
-    }
-    rom.data = malloc(rom.size);
-    if (fread(rom.data, rom.size, 1, rom_file) < 1) {
-        eprintf("%s: Error reading file\n", argv[1]);
-        return 1;
-    }
-    fclose(rom_file);
 
     Driver driver;
     memset(&driver, 0, sizeof(Driver));
     driver.input.lightgun_pos = -1;
     
+    DebugMap *dbg_map = NULL;
+    if (argc >= 3) {
+        dbg_map = malloc(sizeof(DebugMap));
+        if (!debug_map_load(dbg_map, argv[2])) {
+            eprintf("%s: Error opening file\n", argv[2]);
+            return 1;
+        }
+        eprintf("Read %d labels from %s\n", dbg_map->labels_len, argv[2]);
+        driver.dbg_map = dbg_map;
+    }
+    
     // Identify file type and pass to the appropriate loader
     int error_code = 1;
     eprintf("%s: ", argv[1]);
@@ -59,20 +55,6 @@ int main(int argc, char *argv[]) {
         return error_code;
     }
     
-    /*DebugMap *dbg_map = NULL;
-    if (argc >= 3) {
-        dbg_map = malloc(sizeof(DebugMap) * 2000); // TODO: figure out size
-        FILE *map_file = fopen(argv[2], "r");
-        int i = 0;
-        while (fscanf(map_file, "%255s @ %4hx", dbg_map[i].label,
-                      &(dbg_map[i].addr)) == 2) {
-            i++;
-        }
-        dbg_map[i + 1].label[0] = 0;
-        eprintf("Read %d entries from %s\n", i, argv[2]);
-        fclose(map_file);
-    }*/
-        
     Window wnd;
 #ifdef _WIN32
     char *fn = strdup(argv[1]);
@@ -88,13 +70,14 @@ int main(int argc, char *argv[]) {
     window_cleanup(&wnd);
     
     free(fn);
-    /*if (dbg_map) {
-        free(dbg_map);
-    }*/
     
     if (driver.teardown_func) {
         (*driver.teardown_func)(&driver);
     }
+    if (dbg_map) {
+        debug_map_teardown(dbg_map);
+        free(dbg_map);
+    }
     free(rom.data);
     
     return 0;
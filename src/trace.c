@@ -0,0 +1,122 @@
+#include "common.h"
+#include <inttypes.h>
+#include <unistd.h>
+
+#include "cpu/65xx.h"
+#include "debug_map.h"
+#include "f/trace.h"
+
+#define CHUNK_RECORDS 4096
+
+static void print_record(CPU65xx *cpu, const DebugMap *map,
+                         const TraceRecord *r, bool show_registers) {
+    // Same output as the old verbose mode, which skipped over the
+    // instruction at "EndlessLoop" to keep the output readable
+    const char *label = (map ? debug_map_get(map, r->pc) : NULL);
+    if (label && r->type == TR_INSTRUCTION) {
+        if (!strcmp(label, "EndlessLoop")) {
+            return;
+        }
+        printf(":%s\n", label);
+    }
+    char text[32];
+    switch (r->type) {
+        case TR_NMI:
+            snprintf(text, sizeof(text), "/NMI");
+            break;
+        case TR_IRQ:
+            snprintf(text, sizeof(text), "/IRQ");
+            break;
+        default:
+            cpu_65xx_disassemble(cpu, text, sizeof(text), r->inst, r->operand);
+            break;
+    }
+    if (show_registers) {
+        printf("$%04x %-16s A=%02x X=%02x Y=%02x P=%02x S=%02x "
+               "CYC=%" PRIu64 " PPU=%3d,%3d\n",
+               r->pc, text, r->a, r->x, r->y, r->p, r->s,
+               r->mclk / T_CPU_MULTIPLIER, r->scanline, r->cycle);
+    } else {
+        printf("$%04x %s\n", r->pc, text);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    const char *app_path = argv[0];
+    const char *labels_path = NULL;
+    bool show_registers = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "l:r")) != -1) {
+        switch (opt) {
+            case 'l':
+                labels_path = optarg;
+                break;
+            case 'r':
+                show_registers = true;
+                break;
+            default:
+                argc = 0;
+                break;
+        }
+    }
+    argc -= optind;
+    argv += optind;
+    if (argc < 1) {
+        eprintf("Usage: %s [-r] [-l labels.map] trace_file\n", app_path);
+        return 1;
+    }
+    DebugMap *map = NULL;
+    if (labels_path) {
+        map = malloc(sizeof(DebugMap));
+        if (!debug_map_load(map, labels_path)) {
+            eprintf("%s: Error opening file\n", labels_path);
+            return 1;
+        }
+    }
+
+    FILE *trace_file = fopen(argv[0], "rb");
+    if (!trace_file) {
+        eprintf("%s: Error opening file\n", argv[0]);
+        return 1;
+    }
+    TraceHeader header;
+    if (fread(&header, sizeof(TraceHeader), 1, trace_file) < 1 ||
+        memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) ||
+        header.version != TRACE_VERSION ||
+        header.record_size != sizeof(TraceRecord)) {
+        eprintf("%s: Not a compatible trace file\n", argv[0]);
+        return 1;
+    }
+
+    // Only used for its opcode table
+    CPU65xx cpu;
+    cpu_65xx_init(&cpu, NULL, NULL, NULL);
+
+    TraceRecord *records = malloc(sizeof(TraceRecord) * CHUNK_RECORDS);
+    int scanline = INT32_MIN;
+    size_t n;
+    while ((n = fread(records, sizeof(TraceRecord), CHUNK_RECORDS,
+                      trace_file))) {
+        for (size_t i = 0; i < n; i++) {
+            const TraceRecord *r = &records[i];
+            // The PPU used to print this after the CPU ran on the same cycle
+            const bool is_new_line = (r->scanline != scanline);
+            scanline = r->scanline;
+            if (is_new_line && r->cycle) {
+                printf("-- Scanline %d --\n", scanline);
+            }
+            print_record(&cpu, map, r, show_registers);
+            if (is_new_line && !r->cycle) {
+                printf("-- Scanline %d --\n", scanline);
+            }
+        }
+    }
+    fclose(trace_file);
+    free(records);
+    if (map) {
+        debug_map_teardown(map);
+        free(map);
+    }
+
+    return 0;
+}
@@ -21,15 +21,6 @@ static const SDL_Scancode keys[] = {
     SDL_SCANCODE_UP, SDL_SCANCODE_DOWN, SDL_SCANCODE_LEFT, SDL_SCANCODE_RIGHT,
 };
 
-static bool get_env_bool(const char *name, bool *value) {
-    const char *content = getenv(name);
-    if (content) {
-        *value = content[0] && strcmp(content, "0");
-        return true;
-    }
-    return false;
-}
-
 static int identify_js(Window *wnd, SDL_JoystickID which) {
     SDL_GameController *js = SDL_GameControllerFromInstanceID(which);
     for (int i = 0; i < 2; i++) {
@@ -124,12 +115,9 @@ int thread_vm(Driver *driver) {
                                 / driver->refresh_rate;
     const uint64_t delay_units = SDL_GetPerformanceFrequency() / 1000;
     
-    const char *const verb_char = getenv("VERBOSE");
-    const bool verbose = verb_char ? *verb_char - '0' : false;
-    
     uint64_t t_next = SDL_GetPerformanceCounter();
     while (driver->message != MSG_TERMINATE) {
-        (*driver->advance_frame_func)(driver->vm, driver->frame, verbose);
+        (*driver->advance_frame_func)(driver->vm, driver->frame);
         
         t_next += frame_length;
         int64_t t_left = t_next - SDL_GetPerformanceCounter();
@@ -270,9 +258,6 @@ void window_cleanup(Window *wnd) {
 }
 
 void window_loop(Window *wnd) {
-    bool verbose = false;
-    get_env_bool("VERBOSE", &verbose);
-    
     uint32_t *ctrls = wnd->driver->input.controllers;
     
     // Start emulation thread